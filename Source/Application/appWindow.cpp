@@ -26,6 +26,7 @@
 #include <QFormLayout>
 #include <QDialogButtonBox>
 #include <QFile>
+#include <QStatusBar>
 
 // Colors for up to 256 materials. Colors are generated from a base color and a hue shift 
 static const QColor baseColors[30] = {
@@ -41,7 +42,8 @@ static const int hueShift[9] = { 0, 240, 120, 300, 180, 60, 330, 210, 90 };
 AppWindow::AppWindow(MainWindow *mw)
 	: 
 	m_mainWindow(mw),
-	m_surfaceNet(nullptr)
+	m_surfaceNet(nullptr),
+	m_rawVolume(nullptr)
 {
 	// Initialize relaxation attributes
 	initRelaxAttrs();
@@ -72,11 +74,15 @@ AppWindow::AppWindow(MainWindow *mw)
 	connect(m_setNumIterWidget, SIGNAL(valueChanged(float)), this, SLOT(setRelaxNumIterations(float)));
 	connect(m_setFactorWidget, SIGNAL(valueChanged(float)), this, SLOT(setRelaxFactor(float)));
 
-	// Create a table for material rendering properties
+	// Create a shading toggle and a table for material rendering properties
 	m_renderingGroupBox.setLayout(&m_renderingLayout);
 	m_renderingGroupBox.setTitle(tr("Rendering"));
 	m_controlLayout.addWidget(&m_renderingGroupBox, 0, Qt::AlignBottom);
 
+	m_smoothShadingCheckBox.setText(tr("Smooth Shading"));
+	m_renderingLayout.addWidget(&m_smoothShadingCheckBox, 0);
+	connect(&m_smoothShadingCheckBox, &QCheckBox::toggled, this, &AppWindow::setSmoothShading);
+
 	m_renderingLayout.addWidget(&m_materialTable, 0);
 	connect(&m_materialTable, SIGNAL(cellClicked(int, int)), this, SLOT(tableCellClicked(int, int)));
 	connect(&m_materialTable, &MaterialTable::colorChanged, this, &AppWindow::renderParameterChanged);
@@ -104,24 +110,32 @@ void AppWindow::keyPressEvent(QKeyEvent *e)
 	}
 }
 
-// Note that while labels between 0 and 65534 are supported by the SurfaceNets library, only 
+// Note that while 8, 16 and 32-bit labels are supported by the SurfaceNets library, only 
 // the first 256 labels are rendered (to increase this number, the glShader needs to be 
 // updated).
-void AppWindow::onNewData(unsigned short* data, int arraySize[3], float voxelSize[3])
+template <typename Label>
+void AppWindow::onNewData(Label* data, int arraySize[3], float voxelSize[3])
 {
-	// Clean up previous SurfaceNet
-	delete m_surfaceNet;
-
 	// Make the SurfaceNet
-	m_surfaceNet = new MMSurfaceNet(data, arraySize, voxelSize);
+	onNewSurfaceNet(new MMSurfaceNet(data, arraySize, voxelSize), nullptr);
+}
+
+void AppWindow::onNewSurfaceNet(MMSurfaceNet* surfaceNet, MMRawVolume* rawVolume)
+{
+	// Clean up the previous SurfaceNet before the raw volume it references
+	delete m_surfaceNet;
+	delete m_rawVolume;
+	m_surfaceNet = surfaceNet;
+	m_rawVolume = rawVolume;
 
 	// Use current parameters to relax the SurfaceNet
-	m_surfaceNet->relax(m_relaxAttrs);
+	m_surfaceNet->relaxTo(m_relaxAttrs);
 
 	// Update the material table. In this application, a material index of zero
-	// is used for the background
+	// is used for the background. Rows and colors are indexed by the compact label
+	// index (MMSurfaceNet::labelIndex()), which is also the GL texture coordinate.
 	m_materialTable.clear();
-	std::vector<int> materials = m_surfaceNet->labels();
+	std::vector<unsigned int> materials = m_surfaceNet->labels();
 	std::vector<QColor> colors;
 	std::vector<bool> isVisible;
 	int numBaseColors = sizeof(baseColors) / sizeof(QColor);
@@ -222,70 +236,37 @@ void AppWindow::makeSpheres(int numSpheres, int arraySize[3], float voxelSize[3]
 
 void AppWindow::importRaw(const char* rawFilename, int bytesPerVoxel, int arraySize[3], float voxelSize[3])
 {
-	// Open the raw data file and read data
-	FILE* fp;
-	int openErr = 0;
-	if (!(fp = fopen(rawFilename, "rb"))) return;
-
-	unsigned short* data;
-	int inputSize = arraySize[0] * arraySize[1] * arraySize[2];
-	try {
-		data = new unsigned short[inputSize];
-	}
-	catch (std::bad_alloc& ba) {
-		fclose(fp);
+	// Labels are surfaced in their own type (unsigned char, unsigned short or unsigned 
+	// int). Other data types are not handled.
+	MMSurfaceNet::LabelType labelType;
+	if (bytesPerVoxel == 1) labelType = MMSurfaceNet::LabelType::UInt8;
+	else if (bytesPerVoxel == 2) labelType = MMSurfaceNet::LabelType::UInt16;
+	else if (bytesPerVoxel == 4) labelType = MMSurfaceNet::LabelType::UInt32;
+	else return;
+
+	// Map the raw data file and generate a SurfaceNet over the mapped labels without 
+	// reading them into memory first. Construction reads every label, so the file is
+	// paged in first; time spent reading the file and time spent constructing the
+	// SurfaceNet are then shown separately in the status bar.
+	MMRawVolume* rawVolume = new MMRawVolume(rawFilename, labelType, arraySize);
+	if (!rawVolume->isValid()) {
+		delete rawVolume;
 		return;
 	}
-
-	if (bytesPerVoxel == 2) {
-		// Open the raw data file and read data
-		int numRead = fread(data, sizeof(unsigned short), inputSize, fp);
-		fclose(fp);
-		if (numRead != inputSize) {
-			fclose(fp);
-			delete[] data;
-			return;
-		}
+	rawVolume->pageIn();
+	MMSurfaceNet* surfaceNet = rawVolume->createSurfaceNet(voxelSize);
+	const MMRawVolume::Phase phases[3] = { MMRawVolume::Phase::Map, 
+		MMRawVolume::Phase::PageIn, MMRawVolume::Phase::Construction };
+	const char* phaseNames[3] = { "map", "read", "construct" };
+	QString message = QString("Opened %1:").arg(rawFilename);
+	for (int idxPhase = 0; idxPhase < 3; idxPhase++) {
+		MMRawVolume::PhaseStats stats = rawVolume->phaseStats(phases[idxPhase]);
+		message += QString(" %1 %2 s (%3 page faults, %4 major)%5").arg(phaseNames[idxPhase])
+			.arg(stats.seconds, 0, 'f', 2).arg((qulonglong)stats.numPageFaults)
+			.arg((qulonglong)stats.numMajorPageFaults).arg(idxPhase < 2 ? "," : "");
 	}
-	else if (bytesPerVoxel == 1) {
-		// Open the raw data file, read and convert the data to unsigned shorts
-		unsigned char* input;
-		int bufferSize = arraySize[0] * arraySize[1];
-		try {
-			input = new unsigned char[bufferSize];
-		}
-		catch (std::bad_alloc& ba) {
-			fclose(fp);
-			delete[] data;
-			return;
-		}
-		unsigned short* pData = data;
-		int numRead = 0;
-		for (int k = 0; k < arraySize[2]; k++) {
-			numRead += fread(input, sizeof(unsigned char), bufferSize, fp);
-			unsigned char* pInput = input;
-			for (int j = 0; j < arraySize[1]; j++) {
-				for (int i = 0; i < arraySize[0]; i++) {
-					*pData++ = (unsigned short)*pInput++;
-				}
-			}
-		}
-		delete[] input;
-		if (numRead != inputSize) {
-			fclose(fp);
-			delete[] data;
-			return;
-		}
-	}
-	else {
-		//Other data types not handled
-		return;
-	}
-
-	// Generate the SurfaceNet
-	onNewData(data, arraySize, voxelSize);
-	delete[] data;
-	fclose(fp);
+	m_mainWindow->statusBar()->showMessage(message);
+	onNewSurfaceNet(surfaceNet, rawVolume);
 }
 
 void AppWindow::onNew()
@@ -335,14 +316,16 @@ void AppWindow::onExport()
 	dialog.setFileMode(QFileDialog::Directory);
 	QString path = QFileDialog::getExistingDirectory(0, ("Select Output Folder"), QDir::currentPath());
 
-	// Export an OBJ file for each material to the specified path
-	std::vector<int> materials = geometry->labels();
-	for (std::vector<int>::iterator itMatIdx = materials.begin(); itMatIdx != materials.end(); itMatIdx++) {
-		QString filename = path + QString("/") + QString::number(*itMatIdx) + QString(".obj");
+	// Export an OBJ file for each material to the specified path. OBJ data for all 
+	// materials is extracted in parallel before the files are written.
+	std::vector<unsigned int> materials = geometry->labels();
+	std::vector<MMGeometryOBJ::OBJData> materialData = geometry->objData(materials);
+	for (size_t idxMat = 0; idxMat < materials.size(); idxMat++) {
+		QString filename = path + QString("/") + QString::number(materials[idxMat]) + QString(".obj");
 		QFile file(filename);
 		if (file.open(QIODevice::WriteOnly)) {
 			QTextStream stream(&file);
-			MMGeometryOBJ::OBJData data = geometry->objData(*itMatIdx);
+			MMGeometryOBJ::OBJData &data = materialData[idxMat];
 			for (std::vector<std::array<float, 3>>::iterator v = data.vertexPositions.begin(); v != data.vertexPositions.end(); v++) {
 				stream << "v " << (*v)[0] << ' ' << (*v)[1] << ' ' << (*v)[2] << endl;
 			}
@@ -359,12 +342,19 @@ void AppWindow::initRelaxAttrs()
 	m_relaxAttrs.relaxFactor = 0.5f;
 	m_relaxAttrs.numRelaxIterations = 20;
 	m_relaxAttrs.maxDistFromCellCenter = 1.0f;
+	m_relaxAttrs.relaxMethod = MMSurfaceNet::RelaxMethod::Jacobi;
+	m_relaxAttrs.numThreads = 0;
+	m_relaxAttrs.convergenceTolerance = 0.0f;
+	m_relaxAttrs.convergenceNorm = MMSurfaceNet::ConvergenceNorm::MaxDisplacement;
+	m_relaxAttrs.activeSetEpsilon = 0.0f;
 }
 void AppWindow::onRelax()
 {
-	// Relax the surface net, reset the geometry and re-render
-	m_surfaceNet->reset();
-	m_surfaceNet->relax(m_relaxAttrs);
+	// Relax the surface net, reset the geometry and re-render. The surface net only 
+	// relaxes from scratch when it cannot continue from its current state (e.g., when
+	// the relaxation factor or maximum distance is changed or the number of iterations
+	// is decreased); increasing the number of iterations continues the relaxation.
+	m_surfaceNet->relaxTo(m_relaxAttrs);
 	glView->makeGeometry(m_surfaceNet);
 	glView->update();
 }
@@ -399,11 +389,19 @@ void AppWindow::renderParameterChanged()
 {
 	std::vector<QColor> colors;
 	std::vector<bool> isVisible;
-	std::vector<int> materials = m_surfaceNet->labels();
+	std::vector<unsigned int> materials = m_surfaceNet->labels();
 	for (int i = 0; i < materials.size(); i++) {
 		colors.push_back(m_materialTable.color(i));
 		isVisible.push_back(m_materialTable.visibility(i));
 	}
 	glView->updateRenderParameters(colors, isVisible);
 }
+void AppWindow::setSmoothShading(bool isSmooth)
+{
+	// Remake the geometry with the new shading and re-render
+	glView->setShading(isSmooth ? MMGeometryGL::Shading::Smooth : MMGeometryGL::Shading::Flat);
+	if (m_surfaceNet == nullptr) return;
+	glView->makeGeometry(m_surfaceNet);
+	glView->update();
+}
 
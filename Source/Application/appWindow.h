@@ -8,6 +8,7 @@
 #define WINDOW_H
 
 #include "MMSurfaceNet.h"
+#include "MMRawVolume.h"
 
 #include "MaterialTable.h"
 #include "SetValueGroup.h"
@@ -20,6 +21,7 @@
 #include <QGroupBox>
 #include <QSlider>
 #include <QTextEdit>
+#include <QCheckBox>
 
 class GLView;
 class MainWindow;
@@ -44,6 +46,7 @@ private slots:
 	void setRelaxNumIterations(float numIterations);
 	void tableCellClicked(int, int);
 	void renderParameterChanged();
+	void setSmoothShading(bool isSmooth);
 
 private:
 	void keyPressEvent(QKeyEvent* event) override;
@@ -66,16 +69,20 @@ private:
 
 	QGroupBox m_renderingGroupBox;
 	QVBoxLayout m_renderingLayout;
+	QCheckBox m_smoothShadingCheckBox;
 
 	MaterialTable m_materialTable;
 
 	// Model generation and input
 	void makeSpheres(int numSpheres, int arraySize[3], float voxelSize[3]);
 	void importRaw(const char* rawFilename, int bytesPerVoxel, int arraySize[3], float voxelSize[3]);
-	void onNewData(unsigned short*data, int arraySize[3], float voxelSize[3]);
+	template <typename Label> void onNewData(Label* data, int arraySize[3], float voxelSize[3]);
+	void onNewSurfaceNet(MMSurfaceNet* surfaceNet, MMRawVolume* rawVolume);
 
-	// SurfaceNet
+	// SurfaceNet. SurfaceNets of imported raw files reference the labels of the mapped
+	// raw volume, which is kept until the SurfaceNet is deleted.
 	MMSurfaceNet *m_surfaceNet;
+	MMRawVolume *m_rawVolume;
 	MMSurfaceNet::RelaxAttrs m_relaxAttrs;
 	void initRelaxAttrs();
 };
@@ -10,6 +10,7 @@
 #include "glShaders.h"
 
 #include <QMouseEvent>
+#include <climits>
 #include <math.h>
  
 //
@@ -18,6 +19,7 @@
 GLView::GLView(QWidget *parent)
 	: QOpenGLWidget(parent),
 	m_pGeometry(NULL),
+	m_shading(MMGeometryGL::Shading::Flat),
 	m_numIndices(0),
 	m_xRot(0),
 	m_yRot(0),
@@ -63,17 +65,32 @@ void GLView::updateRenderParameters(std::vector<QColor> colors, std::vector<bool
 
 void GLView::makeGeometry(MMSurfaceNet *surfaceNet)
 {
-	// Make geometry from the SurfaceNet. Store the origin and size for fast access
-	// during rendering
+	// Make geometry from the SurfaceNet with the current shading. Store the origin and
+	// size for fast access during rendering
 	delete m_pGeometry;
-	m_pGeometry = new MMGeometryGL(surfaceNet);
+	m_pGeometry = new MMGeometryGL(surfaceNet, m_shading);
 	m_pGeometry->origin(m_origin);
 	m_pGeometry->maxSize(m_size);
 
-	// Create GL buffers for rendering
-	indexBuffer = makeIndexBuffer(m_pGeometry->indices(), m_pGeometry->numIndices());
-	vertexBuffer = makeVertexBuffer(m_pGeometry->vertices(), m_pGeometry->numVertices());
-	m_numIndices = m_pGeometry->numIndices();
+	// Create GL buffers for rendering. QOpenGLBuffer sizes are limited to INT_MAX bytes, 
+	// so larger geometry is not rendered.
+	size_t numIndices = m_pGeometry->numIndices();
+	size_t numVertices = m_pGeometry->numVertices();
+	if (numIndices * sizeof(GLuint) > INT_MAX || numVertices * sizeof(MMGeometryGL::GLVertex) > INT_MAX) {
+		numIndices = 0;
+		numVertices = 0;
+	}
+	indexBuffer = makeIndexBuffer(m_pGeometry->indices(), (int)numIndices);
+	vertexBuffer = makeVertexBuffer(m_pGeometry->vertices(), (int)numVertices);
+	m_numIndices = (int)numIndices;
+}
+
+void GLView::setShading(MMGeometryGL::Shading shading)
+{
+	// Flat shading gives each quad its own vertices and normal. Smooth shading shares 
+	// vertices between quads and uses averaged normals. Applies to geometry made after
+	// this is set.
+	m_shading = shading;
 }
 
 void GLView::reset()
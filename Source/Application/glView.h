@@ -31,6 +31,7 @@ public:
 
 	void updateRenderParameters(std::vector<QColor> colors, std::vector<bool> isVisible);
 	void makeGeometry(MMSurfaceNet *surfaceNet);
+	void setShading(MMGeometryGL::Shading shading);
 	void reset();
 
 protected:
@@ -44,6 +45,7 @@ protected:
 
 private:
 	MMGeometryGL *m_pGeometry;
+	MMGeometryGL::Shading m_shading;
 	int m_numIndices;
 	float m_origin[3];
 	float m_size[3];
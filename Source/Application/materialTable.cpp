@@ -31,7 +31,7 @@ void MaterialTable::clear()
 	setRowCount(0);
 }
 
-void MaterialTable::addMaterial(int label, QColor color, bool isVisible)
+void MaterialTable::addMaterial(unsigned int label, QColor color, bool isVisible)
 {
 	// Check to see if this material has already been added
 	if (getRow(label) >= 0) return;
@@ -54,10 +54,10 @@ void MaterialTable::addMaterial(int label, QColor color, bool isVisible)
 	m_visibilities.push_back(isVisible);
 }
 
-int MaterialTable::getRow(int label)
+int MaterialTable::getRow(unsigned int label)
 {
 	for (int row = 0; row < this->rowCount(); row++) {
-		int index = this->item(row, 0)->data(Qt::DisplayRole).toInt();
+		unsigned int index = this->item(row, 0)->data(Qt::DisplayRole).toUInt();
 		if (index == label) return row;
 	}
 	return(-1);
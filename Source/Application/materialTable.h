@@ -26,7 +26,7 @@ public:
 
 	void clear();
 
-	void addMaterial(int label, QColor color, bool isVisible);
+	void addMaterial(unsigned int label, QColor color, bool isVisible);
 
 	void setColor(int row, QColor color);
 	QColor color(int row);
@@ -48,7 +48,7 @@ private:
 	QIcon m_visibleIcon;
 	QIcon m_notVisibleIcon;
 
-	int getRow(int label);
+	int getRow(unsigned int label);
 };
 
 #endif
\ No newline at end of file
@@ -2,8 +2,8 @@
 // newModelDialog.cpp
 //
 // Dialog for specifying parameters for opening a raw image file of material
-// labels. Voxel material labels can either be unsigned short or unsigned char. This
-// implementation of SurfaceNets supports labels from 0 to 65534.
+// labels. Voxel material labels can be unsigned char, unsigned short or unsigned int. 
+// The largest value of each type is reserved by SurfaceNets for padding.
 //
 
 #include "openModelFileDialog.h"
@@ -54,6 +54,7 @@ OpenModelFileDialog::OpenModelFileDialog(QWidget* parent) :
 	m_dataType->addItem(" ");
 	m_dataType->addItem("Unsigned Char");
 	m_dataType->addItem("Unsigned Short");
+	m_dataType->addItem("Unsigned Int");
 	m_dataTypeLayout->addRow(tr("Data format:"), m_dataType);
 	m_dataTypeGroup->setLayout(m_dataTypeLayout);
 	m_dialogLayout->addWidget(m_dataTypeGroup);
@@ -121,6 +122,10 @@ int OpenModelFileDialog::getBytesPerVoxel()
 		// Unsigned short: return 2 bytes
 		return(2);
 	}
+	case 3: {
+		// Unsigned int: return 4 bytes
+		return(4);
+	}
 	}
 };
 void OpenModelFileDialog::getDimensions(int dims[3])
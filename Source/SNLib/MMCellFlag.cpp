@@ -6,16 +6,108 @@
 
 #include "MMCellFlag.h"
 #include <type_traits>
+#include <vector>
 
-MMCellFlag::MMCellFlag() :
-m_bitFlag(0)
+#if defined(_M_X64) || defined(__x86_64__)
+#define MM_CELL_FLAG_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline unsigned int lowestSetBit(unsigned int mask)
 {
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned int)index;
 }
-MMCellFlag::~MMCellFlag()
+#else
+static inline unsigned int lowestSetBit(unsigned int mask)
 {
+	return (unsigned int)__builtin_ctz(mask);
 }
+#endif
+#endif
 
-void MMCellFlag::set(unsigned short cellLabels[8])
+static_assert(std::is_trivially_copyable<MMCellFlag>::value && sizeof(MMCellFlag) == 4,
+	"MMCellFlag is stored per cell and must remain a trivially copyable 32-bit word");
+
+//
+// The cell flag depends only on which of the cell's 8 corner labels are equal, i.e., 
+// on the partition of the corners into sets of equal labels. A partition is encoded 
+// canonically by f[0..7], where f[i] is the first corner with the same label as corner
+// i. Because f[i] <= i, f is a mixed-radix number with digit i in base i + 1, and 
+// partitions map to indices in [0, 8!). Flags for all 4140 partitions are computed 
+// once with the reference implementation and stored in a table indexed by this number.
+//
+static const int NumPartitionIndices = 40320;
+static const unsigned int partitionRadix[8] = { 0, 1, 2, 6, 24, 120, 720, 5040 };
+
+#ifdef MM_CELL_FLAG_SSE2
+// The 8 labels fit in two SSE2 registers. Comparing all labels with the label of 
+// corner i gives a mask with 4 bits per corner; its lowest set bit is the first 
+// matching corner.
+static inline unsigned int partitionIndex(const unsigned int cellLabels[8])
+{
+	__m128i labelsLow = _mm_loadu_si128((const __m128i *)cellLabels);
+	__m128i labelsHigh = _mm_loadu_si128((const __m128i *)(cellLabels + 4));
+	unsigned int index = 0;
+	for (int i = 1; i < 8; i++) {
+		__m128i label = _mm_set1_epi32((int)cellLabels[i]);
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi32(labelsLow, label)) |
+			((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi32(labelsHigh, label)) << 16);
+		index += (lowestSetBit(mask) >> 2) * partitionRadix[i];
+	}
+	return index;
+}
+#else
+static inline unsigned int partitionIndex(const unsigned int cellLabels[8])
+{
+	unsigned int index = 0;
+	for (int i = 1; i < 8; i++) {
+		unsigned int firstCorner = 0;
+		while (cellLabels[firstCorner] != cellLabels[i]) firstCorner++;
+		index += firstCorner * partitionRadix[i];
+	}
+	return index;
+}
+#endif
+
+// Table of cell flags for each partition index, built on first use. Initialization of
+// the function-local static is thread safe.
+static const MMCellFlag *partitionFlagTable()
+{
+	static const std::vector<MMCellFlag> table = []() {
+		std::vector<MMCellFlag> flags(NumPartitionIndices);
+
+		// Enumerate restricted growth strings in lexicographic order, using each 
+		// string as a set of corner labels
+		unsigned int cellLabels[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		unsigned int maxLabel[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		while (true) {
+			flags[partitionIndex(cellLabels)].setReference(cellLabels);
+
+			// Increment the last corner that can grow and reset the corners after it
+			int i = 7;
+			while (i > 0 && cellLabels[i] > maxLabel[i - 1]) i--;
+			if (i == 0) break;
+			cellLabels[i]++;
+			maxLabel[i] = (cellLabels[i] > maxLabel[i - 1]) ? cellLabels[i] : maxLabel[i - 1];
+			for (int j = i + 1; j < 8; j++) {
+				cellLabels[j] = 0;
+				maxLabel[j] = maxLabel[j - 1];
+			}
+		}
+		return flags;
+	}();
+	return table.data();
+}
+
+void MMCellFlag::set(unsigned int cellLabels[8])
+{
+	*this = partitionFlagTable()[partitionIndex(cellLabels)];
+}
+
+// Reference implementation of set()
+void MMCellFlag::setReference(unsigned int cellLabels[8])
 {
 	// By default the cell has no vertex and no face or edge crossings
 	m_bitFlag = 0;
@@ -109,7 +201,7 @@ void MMCellFlag::set(unsigned short cellLabels[8])
 	}
 }
 
-MMCellFlag::VertexType MMCellFlag::vertexType()
+MMCellFlag::VertexType MMCellFlag::vertexType() const
 {
 	unsigned int vertexTypeBits = (m_bitFlag & m_vertexTypeBits) >> VertexTypeShift;
 	switch (vertexTypeBits) {
@@ -120,7 +212,7 @@ MMCellFlag::VertexType MMCellFlag::vertexType()
 	default: return(VertexType::NoVertex);
 	}
 }
-MMCellFlag::FaceCrossingType MMCellFlag::faceCrossingType(Face face)
+MMCellFlag::FaceCrossingType MMCellFlag::faceCrossingType(Face face) const
 {
 	unsigned int faceTypeBits = 0;
 	switch (face) {
@@ -153,7 +245,7 @@ MMCellFlag::FaceCrossingType MMCellFlag::faceCrossingType(Face face)
 	default: return(FaceCrossingType::NoFaceCrossing);
 	}
 }
-bool MMCellFlag::isEdgeCrossing(Edge edge)
+bool MMCellFlag::isEdgeCrossing(Edge edge) const
 {
 	switch (edge) {
 	case Edge::LeftBottomEdge: {
@@ -210,11 +302,11 @@ bool MMCellFlag::isEdgeCrossing(Edge edge)
 	}
 }
 
-unsigned int MMCellFlag::faceCrossingTypeAsBits(unsigned short c0,
-	unsigned short c1, unsigned short c2, unsigned short c3)
+unsigned int MMCellFlag::faceCrossingTypeAsBits(unsigned int c0,
+	unsigned int c1, unsigned int c2, unsigned int c3)
 {
 	int numUniqueTypes = 0;
-	unsigned short uniqueTypes[4];
+	unsigned int uniqueTypes[4];
 	uniqueTypes[numUniqueTypes++] = c0;
 	if (c1 != uniqueTypes[0]) uniqueTypes[numUniqueTypes++] = c1;
 	int idx = 0;
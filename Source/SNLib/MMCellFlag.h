@@ -11,12 +11,9 @@
 class MMCellFlag
 {
 public:
-	MMCellFlag();
-	virtual ~MMCellFlag();
-
-	void operator = (const MMCellFlag &t) {
-		m_bitFlag = t.m_bitFlag;
-	}
+	// The cell flag is a plain 32-bit word so that large cell arrays stay compact
+	// and can be copied and cleared trivially
+	MMCellFlag() : m_bitFlag(0) {}
 
 	enum class VertexType {
 		NoVertex, SurfaceVertex, EdgeVertex, CornerVertex
@@ -37,14 +34,17 @@ public:
 	// cell labels of its 8 vertices, which are listed left-to-right, back-to-front,
 	// bottom-to-top (i.e., left-back-bottom vertex first and right-front-top vertex
 	// last). Clearing the cell flag encodes types NoVertex, NoFaceCrossing, and no 
-	// edge or face crossings.
-	void set(unsigned short cellLabels[8]);
+	// edge or face crossings. set() looks up the flag in a table indexed by the pattern
+	// of equal labels; setReference() computes it directly and is used to build the 
+	// table and for validation.
+	void set(unsigned int cellLabels[8]);
+	void setReference(unsigned int cellLabels[8]);
 	void clear() { m_bitFlag = 0; }
 
 	// Get components of the cell flag
-	VertexType vertexType();
-	FaceCrossingType faceCrossingType(Face face);
-	bool isEdgeCrossing(Edge edge);
+	VertexType vertexType() const;
+	FaceCrossingType faceCrossingType(Face face) const;
+	bool isEdgeCrossing(Edge edge) const;
 
 private:
 	// Bit shifts to locate various components of the cell flag
@@ -59,31 +59,31 @@ private:
 	};
 
 	// Flag bits associated with each component of the cell flag
-	const unsigned int m_vertexTypeBits = (1 << VertexTypeShift) | (1 << (VertexTypeShift + 1));
-	const unsigned int m_leftFaceCrossingBits = (1 << LeftFaceShift) | (1 << (LeftFaceShift + 1));
-	const unsigned int m_rightFaceCrossingBits = (1 << RightFaceShift) | (1 << (RightFaceShift + 1));
-	const unsigned int m_backFaceCrossingBits = (1 << BackFaceShift) | (1 << (BackFaceShift + 1));
-	const unsigned int m_frontFaceCrossingBits = (1 << FrontFaceShift) | (1 << (FrontFaceShift + 1));
-	const unsigned int m_bottomFaceCrossingBits = (1 << BottomFaceShift) | (1 << (BottomFaceShift + 1));
-	const unsigned int m_topFaceCrossingBits = (1 << TopFaceShift) | (1 << (TopFaceShift + 1));
-	const unsigned int m_leftBottomEdgeCrossingBit = 1 << 14;
-	const unsigned int m_rightBottomEdgeCrossingBit = 1 << 15;
-	const unsigned int m_backBottomEdgeCrossingBit = 1 << 16;
-	const unsigned int m_frontBottomEdgeCrossingBit = 1 << 17;
-	const unsigned int m_leftTopEdgeCrossingBit = 1 << 18;
-	const unsigned int m_rightTopEdgeCrossingBit = 1 << 19;
-	const unsigned int m_backTopEdgeCrossingBit = 1 << 20;
-	const unsigned int m_frontTopEdgeCrossingBit = 1 << 21;
-	const unsigned int m_leftBackEdgeCrossingBit = 1 << 22;
-	const unsigned int m_rightBackEdgeCrossingBit = 1 << 23;
-	const unsigned int m_leftFrontEdgeCrossingBit = 1 << 24;
-	const unsigned int m_rightFrontEdgeCrossingBit = 1 << 25;
+	static constexpr unsigned int m_vertexTypeBits = (1 << VertexTypeShift) | (1 << (VertexTypeShift + 1));
+	static constexpr unsigned int m_leftFaceCrossingBits = (1 << LeftFaceShift) | (1 << (LeftFaceShift + 1));
+	static constexpr unsigned int m_rightFaceCrossingBits = (1 << RightFaceShift) | (1 << (RightFaceShift + 1));
+	static constexpr unsigned int m_backFaceCrossingBits = (1 << BackFaceShift) | (1 << (BackFaceShift + 1));
+	static constexpr unsigned int m_frontFaceCrossingBits = (1 << FrontFaceShift) | (1 << (FrontFaceShift + 1));
+	static constexpr unsigned int m_bottomFaceCrossingBits = (1 << BottomFaceShift) | (1 << (BottomFaceShift + 1));
+	static constexpr unsigned int m_topFaceCrossingBits = (1 << TopFaceShift) | (1 << (TopFaceShift + 1));
+	static constexpr unsigned int m_leftBottomEdgeCrossingBit = 1 << 14;
+	static constexpr unsigned int m_rightBottomEdgeCrossingBit = 1 << 15;
+	static constexpr unsigned int m_backBottomEdgeCrossingBit = 1 << 16;
+	static constexpr unsigned int m_frontBottomEdgeCrossingBit = 1 << 17;
+	static constexpr unsigned int m_leftTopEdgeCrossingBit = 1 << 18;
+	static constexpr unsigned int m_rightTopEdgeCrossingBit = 1 << 19;
+	static constexpr unsigned int m_backTopEdgeCrossingBit = 1 << 20;
+	static constexpr unsigned int m_frontTopEdgeCrossingBit = 1 << 21;
+	static constexpr unsigned int m_leftBackEdgeCrossingBit = 1 << 22;
+	static constexpr unsigned int m_rightBackEdgeCrossingBit = 1 << 23;
+	static constexpr unsigned int m_leftFrontEdgeCrossingBit = 1 << 24;
+	static constexpr unsigned int m_rightFrontEdgeCrossingBit = 1 << 25;
 
 	// The bitflag
 	unsigned int m_bitFlag;
 
 	// Determine face crossing type from the face's vertex labels
-	unsigned int faceCrossingTypeAsBits(unsigned short c0, unsigned short c1, unsigned short c2, unsigned short c3);
+	static unsigned int faceCrossingTypeAsBits(unsigned int c0, unsigned int c1, unsigned int c2, unsigned int c3);
 };
 
 // For iterating over cell faces
@@ -5,132 +5,111 @@
 // Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
 
 #include <cstdlib>
+#include <atomic>
 #include <exception>
+#include <new>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <limits>
 
 #include "MMSurfaceNet.h"
 #include "MMCellMap.h"
+#include "MMParallel.h"
+#include "MMRelaxKernel.h"
+#include "MMCellScan.h"
 
 // Basic cell map containing material labels
-MMCellMap::MMCellMap(unsigned short *labels, int arraySize[3], float voxelSize[3]) :
-	m_cellArray(NULL),
+MMCellMap::MMCellMap(const void *labels, LabelType labelType, int arraySize[3], 
+	float voxelSize[3], LabelStorage labelStorage, VertexOrder vertexOrder) :
+	m_labelType(labelType),
+	m_labelBytes(labelSize(labelType)),
+	m_padLabel(paddingLabel(labelType)),
+	m_labels(NULL),
+	m_labelCopy(NULL),
+	m_labelBricks(NULL),
+	m_padRow(NULL),
+	m_brickIndices(NULL),
+	m_numBricks(0),
+	m_brickVertexIndices(NULL),
 	m_numVertices(0),
-	m_vertices(NULL)
+	m_vertices(NULL),
+	m_vertexFlags(NULL),
+	m_vertexOffsets(NULL),
+	m_vertexOrder(vertexOrder),
+	m_nbrBegin(NULL),
+	m_nbrIndices(NULL),
+	m_nbrCellDeltaSums(NULL)
 {
-	// Allocate memory for the cell map. To ensure closed shapes and sharp corners
-	// and edges at volume faces, faces are padded by one voxel with a reserved 
-	// label.
+	// To ensure closed shapes and sharp corners and edges at volume faces, faces are
+	// padded by one voxel with a reserved label. Padding labels are not stored; the
+	// cell grid is one cell larger than the label array on each face and labels 
+	// outside the label array are read as the padding label. Labels are stored in 
+	// their original type and widened to unsigned int when they are read.
 	for (int i = 0; i < 3; i++) {
+		m_labelArraySize[i] = arraySize[i];
 		m_arraySize[i] = arraySize[i] + 2;
 		m_voxelSize[i] = voxelSize[i];
 	}
-	int numCells = m_arraySize[0] * m_arraySize[1] * m_arraySize[2];
+	size_t labelSliceBytes = (size_t)arraySize[0] * arraySize[1] * m_labelBytes;
 	try {
-		m_cellArray = new Cell[numCells];
+		if (labelStorage == LabelStorage::CopyLabels) {
+			m_labelCopy = new unsigned char[labelSliceBytes * arraySize[2]];
+		}
+		else if (labelStorage == LabelStorage::CompressLabels) {
+			m_labelBricks = new MMLabelBricks(labels, labelType, arraySize);
+		}
+		m_padRow = new unsigned char[(size_t)arraySize[0] * m_labelBytes];
 	}
 	catch (std::bad_alloc& ba) {
-		m_cellArray = NULL;
+		freeMemory();
+		return;
+	}
+	if (m_labelBricks && !m_labelBricks->isValid()) {
+		freeMemory();
 		return;
 	}
 
-	// Initialize interior cell contents. Each cell stores the label of it's bottom, left, back
-	// corner.
-	Cell* pCell = m_cellArray;
-	unsigned short* pLabel = labels;
-	unsigned short padLabel = (unsigned short) MMSurfaceNet::ReservedLabel::Pading;
-	for (int k = 0; k < m_arraySize[2]; k++) {
-		for (int j = 0; j < m_arraySize[1]; j++) {
-			for (int i = 0; i < m_arraySize[0]; i++) {
-				if (i == 0 || i == m_arraySize[0] - 1 ||
-					j == 0 || j == m_arraySize[1] - 1 || 
-					k == 0 || k == m_arraySize[2] - 1) {
-					initCell(pCell++, padLabel);
-				}
-				else {
-					initCell(pCell++, *pLabel++);
-				}
-			}
-		}
+	// The padding label has all bits set for every label type
+	std::fill(m_padRow, m_padRow + (size_t)arraySize[0] * m_labelBytes, 0xFF);
+	const unsigned char *labelBytes = (const unsigned char *)labels;
+
+	// Copy labels in parallel z-slices if requested
+	if (m_labelCopy) {
+		int numThreads = MMParallel::numThreads(0);
+		MMParallel::forRange(0, arraySize[2], numThreads, [&](int beginK, int endK) {
+			std::copy(&labelBytes[beginK * labelSliceBytes], &labelBytes[endK * labelSliceBytes], 
+				&m_labelCopy[beginK * labelSliceBytes]);
+		});
 	}
+	m_labels = m_labelCopy ? m_labelCopy : (m_labelBricks ? NULL : labelBytes);
 
-	// Set the cell vertices
+	// Set the cell vertices and label statistics
 	setCellVertices();
+	if (isValid()) setLabelStats();
 }
 MMCellMap::~MMCellMap()
 {
-	if (m_cellArray) delete[] m_cellArray;
-	if (m_vertices) delete[] m_vertices;
+	freeMemory();
+}
+bool MMCellMap::isValid()
+{
+	// The brick table is allocated for any volume and freed if any allocation fails
+	return m_brickIndices != NULL;
 }
 
 // Relax vertex positions using relaxation attributes or reset to cell centers
-void MMCellMap::relax(MMSurfaceNet::RelaxAttrs relaxAttrs)
+MMSurfaceNet::RelaxStats MMCellMap::relax(MMSurfaceNet::RelaxAttrs relaxAttrs)
 {
-	for (int i = 0; i < relaxAttrs.numRelaxIterations; i++) {
-		for (int idxVtx = 0; idxVtx < m_numVertices; idxVtx++) {
-			int cellIdx[3];
-			getVertexCellIndex(idxVtx, cellIdx);
-			Cell *pCell = getCell(cellIdx);
-
-			int numNeighbors = 0;
-			float avgP[3] = { 0.0f, 0.0f, 0.0f };
-			if (pCell->flag.vertexType() == MMCellFlag::VertexType::SurfaceVertex) {
-				for (MMCellFlag::Face face = MMCellFlag::Face::LeftFace; face <= MMCellFlag::Face::TopFace; ++face) {
-					if (pCell->flag.faceCrossingType(face) != MMCellFlag::FaceCrossingType::NoFaceCrossing) {
-						int nbrIdx[3];
-						Cell *nbrCell = getFaceNeighborCellAndIndex(cellIdx, face, nbrIdx);
-						avgP[0] += nbrCell->vertexOffset[0] + nbrIdx[0] - cellIdx[0];
-						avgP[1] += nbrCell->vertexOffset[1] + nbrIdx[1] - cellIdx[1];
-						avgP[2] += nbrCell->vertexOffset[2] + nbrIdx[2] - cellIdx[2];
-						numNeighbors++;
-					}
-				}
-			}
-			else {
-				for (MMCellFlag::Face face = MMCellFlag::Face::LeftFace; face <= MMCellFlag::Face::TopFace; ++face) {
-					if (pCell->flag.faceCrossingType(face) == MMCellFlag::FaceCrossingType::JunctionFaceCrossing) {
-						int nbrIdx[3];
-						Cell *nbrCell = getFaceNeighborCellAndIndex(cellIdx, face, nbrIdx);
-						avgP[0] += nbrCell->vertexOffset[0] + nbrIdx[0] - cellIdx[0];
-						avgP[1] += nbrCell->vertexOffset[1] + nbrIdx[1] - cellIdx[1];
-						avgP[2] += nbrCell->vertexOffset[2] + nbrIdx[2] - cellIdx[2];
-						numNeighbors++;
-					}
-				}
-			}
-
-			// Add a fraction of the averaged vertex position to the current position
-			float *p = pCell->vertexOffset;
-			if (numNeighbors > 0) {
-				avgP[0] /= (float)numNeighbors;
-				avgP[1] /= (float)numNeighbors;
-				avgP[2] /= (float)numNeighbors;
-				float alpha = relaxAttrs.relaxFactor;
-				p[0] = (1.0 - alpha) * p[0] + alpha * avgP[0];
-				p[1] = (1.0 - alpha) * p[1] + alpha * avgP[1];
-				p[2] = (1.0 - alpha) * p[2] + alpha * avgP[2];
-
-				// Constrain vertex location to a max distance from the original voxel
-				float min = 0.5 - relaxAttrs.maxDistFromCellCenter;
-				float max = 0.5 + relaxAttrs.maxDistFromCellCenter;
-				if (p[0] < min) p[0] = min;
-				if (p[0] > max) p[0] = max;
-				if (p[1] < min) p[1] = min;
-				if (p[1] > max) p[1] = max;
-				if (p[2] < min) p[2] = min;
-				if (p[2] > max) p[2] = max;
-			}
-		}
+	if (relaxAttrs.relaxMethod == MMSurfaceNet::RelaxMethod::Jacobi) {
+		return relaxJacobi(relaxAttrs);
 	}
+	return relaxSequential(relaxAttrs);
 }
 void MMCellMap::reset()
 {
-	for (int idxVtx = 0; idxVtx < m_numVertices; idxVtx++) {
-		int cellIdx[3];
-		getVertexCellIndex(idxVtx, cellIdx);
-		Cell *pCell = getCell(cellIdx);
-		pCell->vertexOffset[0] = 0.5f;
-		pCell->vertexOffset[1] = 0.5f;
-		pCell->vertexOffset[2] = 0.5f;
-	}
+	if (m_vertexOffsets == NULL) return;
+	std::fill(m_vertexOffsets, m_vertexOffsets + 3 * m_numVertices, 0.5f);
 }
 
 // Data for export
@@ -150,27 +129,61 @@ int MMCellMap::numVertices()
 {
 	return m_numVertices;
 }
-int MMCellMap::numEdgeCrossings()
-{
-	int cellMapIdx = 0;
-	int numCrossings = 0;
-	for (int k = 0; k < m_arraySize[2]; k++) {
-		for (int j = 0; j < m_arraySize[1]; j++) {
-			for (int i = 0; i < m_arraySize[0]; i++) {
-				if (isEdgeCrossing(cellMapIdx, MMCellFlag::Edge::LeftBackEdge)) numCrossings++;
-				if (isEdgeCrossing(cellMapIdx, MMCellFlag::Edge::LeftBottomEdge)) numCrossings++;
-				if (isEdgeCrossing(cellMapIdx, MMCellFlag::Edge::BackBottomEdge)) numCrossings++;
-				cellMapIdx++;
-			}
-		}
+size_t MMCellMap::numEdgeCrossings()
+{
+	// Only cells with vertices can have edge crossings
+	size_t numCrossings = 0;
+	for (int idxVtx = 0; idxVtx < m_numVertices; idxVtx++) {
+		MMCellFlag flag = m_vertexFlags[idxVtx];
+		if (flag.isEdgeCrossing(MMCellFlag::Edge::LeftBackEdge)) numCrossings++;
+		if (flag.isEdgeCrossing(MMCellFlag::Edge::LeftBottomEdge)) numCrossings++;
+		if (flag.isEdgeCrossing(MMCellFlag::Edge::BackBottomEdge)) numCrossings++;
 	}
 	return numCrossings;
 }
+const std::vector<MMSurfaceNet::LabelStats> &MMCellMap::labelStats()
+{
+	return m_labelStats;
+}
+int MMCellMap::labelIndex(unsigned int label)
+{
+	if (!m_labelIndexTable.empty()) {
+		return (label < m_labelIndexTable.size()) ? m_labelIndexTable[label] : -1;
+	}
+	std::vector<MMSurfaceNet::LabelStats>::const_iterator itStats = std::lower_bound(m_labelStats.begin(), 
+		m_labelStats.end(), label, [](const MMSurfaceNet::LabelStats &s, unsigned int label) { return s.label < label; });
+	if (itStats == m_labelStats.end() || itStats->label != label) return -1;
+	return (int)(itStats - m_labelStats.begin());
+}
+// Bytes allocated for labels. Referenced labels are owned by the caller.
+size_t MMCellMap::labelMemorySize()
+{
+	size_t numLabels = (size_t)m_labelArraySize[0] * m_labelArraySize[1] * m_labelArraySize[2];
+	if (m_labelCopy) return numLabels * m_labelBytes;
+	if (m_labelBricks) return m_labelBricks->memorySize();
+	return 0;
+}
+// Bytes allocated for labels, bricks of cells and vertex data
+size_t MMCellMap::memorySize()
+{
+	size_t numBrickCells = (size_t)m_brickArraySize[0] * m_brickArraySize[1] * m_brickArraySize[2];
+	size_t bytesPerVertex = sizeof(Vertex) + sizeof(MMCellFlag) + 3 * sizeof(float);
+	size_t cellBytes = m_brickIndices ? numBrickCells * sizeof(int) : 0;
+	if (m_brickVertexIndices) cellBytes += (size_t)m_numBricks * BrickCells * sizeof(int);
+	size_t labelBytes = labelMemorySize();
+	size_t vertexBytes = m_vertices ? (size_t)m_numVertices * bytesPerVertex : 0;
+	size_t nbrBytes = 0;
+	if (m_nbrIndices) {
+		nbrBytes = (m_numVertices + 1) * sizeof(int) + 3 * m_numVertices * sizeof(float) + 
+			(size_t)m_nbrBegin[m_numVertices] * sizeof(int);
+	}
+	size_t labelStatsBytes = m_labelStats.size() * sizeof(MMSurfaceNet::LabelStats) + 
+		m_labelIndexTable.size() * sizeof(int);
+	return labelBytes + cellBytes + vertexBytes + nbrBytes + labelStatsBytes;
+}
 MMCellFlag::VertexType MMCellMap::vertexType(int vertexIndex)
 {
-	int cellIndex[3];
-	getVertexCellIndex(vertexIndex, cellIndex);
-	return(cellVertexType(cellArrayIndex(cellIndex)));
+	return(m_vertexFlags[vertexIndex].vertexType());
 }
 // Returns true if there is an edge crossing and false otherwise. If there is an edge 
 // crossing, we defince a surface quad from vertices in the 4 cells touching the edge.
@@ -179,13 +192,13 @@ MMCellFlag::VertexType MMCellMap::vertexType(int vertexIndex)
 // into quadLabels as [labelTopFaceOfQuad, labelBottomFaceOfQuad]. If there is no edge 
 // crossing, quadCorners and quadLabels will not be set.
 bool MMCellMap::getEdgeQuad(int vertexIndex, MMCellFlag::Edge edge, float quadCorners[12],
-	unsigned short quadLabels[2])
+	unsigned int quadLabels[2])
 {
-	int cellIndex[3];
-	getVertexCellIndex(vertexIndex, cellIndex);
-	if (!isEdgeCrossing(cellArrayIndex(cellIndex), edge)) {
+	if (!m_vertexFlags[vertexIndex].isEdgeCrossing(edge)) {
 		return false;
 	}
+	int cellIndex[3];
+	getVertexCellIndex(vertexIndex, cellIndex);
 
 	// Because there is an edge crossing, cell map access in the following will be 
 	// in-bounds by construction of the cell map.
@@ -200,13 +213,13 @@ bool MMCellMap::getEdgeQuad(int vertexIndex, MMCellFlag::Edge edge, float quadCo
 // labelBottomFaceOfQuad]. If there is no edge crossing, quadCorners and quadLabels 
 // will not be set.
 bool MMCellMap::getEdgeQuad(int vertexIndex, MMCellFlag::Edge edge, int quadVtxIndices[4],
-	unsigned short quadLabels[2])
+	unsigned int quadLabels[2])
 {
-	int cellIndex[3];
-	getVertexCellIndex(vertexIndex, cellIndex);
-	if (!isEdgeCrossing(cellArrayIndex(cellIndex), edge)) {
+	if (!m_vertexFlags[vertexIndex].isEdgeCrossing(edge)) {
 		return false;
 	}
+	int cellIndex[3];
+	getVertexCellIndex(vertexIndex, cellIndex);
 
 	// Because there is an edge crossing, cell map access in the following will be 
 	// in-bounds by construction of the cell map.
@@ -215,131 +228,834 @@ bool MMCellMap::getEdgeQuad(int vertexIndex, MMCellFlag::Edge edge, int quadVtxI
 	return true;
 }
 
-void MMCellMap::getVertexPosition(int vertexIndex, float position[3])
+bool MMCellMap::isEdgeCrossing(int vertexIndex, MMCellFlag::Edge edge)
 {
-	getVertexPosition(m_vertices[vertexIndex].cellIndex, position);
+	return m_vertexFlags[vertexIndex].isEdgeCrossing(edge);
+}
+void MMCellMap::getQuadVtxIndices(int vertexIndex, MMCellFlag::Edge edge, int quadVtxIndices[4])
+{
+	getEdgeQuadVtxIndices(m_vertices[vertexIndex].cellIndex, edge, quadVtxIndices);
+}
+void MMCellMap::getQuadLabels(int vertexIndex, MMCellFlag::Edge edge, unsigned int quadLabels[2])
+{
+	getEdgeLabels(m_vertices[vertexIndex].cellIndex, edge, quadLabels);
 }
 
-void MMCellMap::initCell(Cell* cell, unsigned short label)
+void MMCellMap::getVertexPosition(int vertexIndex, float position[3])
+{
+	int *cellIndex = m_vertices[vertexIndex].cellIndex;
+	float *offset = &m_vertexOffsets[3 * vertexIndex];
+	position[0] = m_voxelSize[0] * (cellIndex[0] + offset[0]);
+	position[1] = m_voxelSize[1] * (cellIndex[1] + offset[1]);
+	position[2] = m_voxelSize[2] * (cellIndex[2] + offset[2]);
+}
+// Vertices in ScanOrder are sorted by z-index, so the first vertex is found by bisection
+int MMCellMap::firstVertexInSlice(int k)
 {
-	cell->label = label;
-	cell->flag.clear();
-	cell->vertexIndex = -1;
-	cell->vertexOffset[0] = 0.5f;
-	cell->vertexOffset[1] = 0.5f;
-	cell->vertexOffset[2] = 0.5f;
+	const Vertex *vertex = std::lower_bound(m_vertices, m_vertices + m_numVertices, k, 
+		[](const Vertex &v, int k) { return v.cellIndex[2] < k; });
+	return (int)(vertex - m_vertices);
 }
 
 void MMCellMap::setCellVertices()
 {
-	// Set cell type and count cell vertices. There are no vertices in right, front, 
-	// top faces.
-	m_numVertices = 0;
-	for (int k = 0; k < m_arraySize[2] - 1; k++) {
-		for (int j = 0; j < m_arraySize[1] - 1; j++) {
-			for (int i = 0; i < m_arraySize[0] - 1; i++) {
-				Cell* pCell = getCell(i, j, k);
-				unsigned short cellLabels[8];
-				getCellLabels(pCell, cellLabels);
-				pCell->flag.set(cellLabels);
-				if (pCell->flag.vertexType() != MMCellFlag::VertexType::NoVertex) {
-					m_numVertices++;
+	// Allocate the brick table. Bricks are allocated below if they contain vertices.
+	int numBricks = 1;
+	for (int i = 0; i < 3; i++) {
+		m_brickArraySize[i] = (m_arraySize[i] + BrickSize - 1) >> BrickShift;
+		numBricks *= m_brickArraySize[i];
+	}
+	try {
+		m_brickIndices = new int[numBricks];
+	}
+	catch (std::bad_alloc& ba) {
+		freeMemory();
+		return;
+	}
+	std::fill(m_brickIndices, m_brickIndices + numBricks, -1);
+
+	// Find cells with vertices in parallel slabs of bricks (BrickSize z-slices of cells).
+	// There are no vertices in right, front, top faces. Each slab lists its vertex 
+	// cells and their flags in cell order and marks the bricks that contain them; bricks
+	// belong to a single slab, so slabs can mark bricks independently.
+	//
+	// Cells with vertices have corner labels that are not all equal. Each row of cells 
+	// is scanned for these cells with SIMD comparisons of its 4 label rows, so cell 
+	// flags are only computed for cells on material boundaries. For BrickOrder, each 
+	// slab's vertices are then sorted into brick order.
+	//
+	// An exception thrown on a worker thread would terminate the program, so allocation
+	// failures are caught by each thread and leave the cell map empty after the join.
+	int numSlices = m_arraySize[2] - 1;
+	int numSlabs = m_brickArraySize[2];
+	int slabSize = m_brickArraySize[0] * m_brickArraySize[1];
+	std::vector<std::vector<Vertex> > slabVertices(numSlabs);
+	std::vector<std::vector<MMCellFlag> > slabFlags(numSlabs);
+	int numThreads = MMParallel::numThreads(0);
+	MMRelaxKernel::InstructionSet instructionSet = MMRelaxKernel::bestInstructionSet();
+	int numRowCells = m_arraySize[0] - 1;
+	std::atomic<bool> isOutOfMemory(false);
+	MMParallel::forRange(0, numSlabs, numThreads, [&](int beginSlab, int endSlab) {
+		try {
+			std::vector<int> rowCells(numRowCells);
+			LabelRows labelRows;
+			initLabelRows(labelRows);
+			for (int slab = beginSlab; slab < endSlab; slab++) {
+				std::vector<Vertex> &vertices = slabVertices[slab];
+				std::vector<MMCellFlag> &flags = slabFlags[slab];
+				int *slabBricks = &m_brickIndices[slab * slabSize];
+				int endK = std::min((slab + 1) * BrickSize, numSlices);
+				for (int k = slab * BrickSize; k < endK; k++) {
+					for (int j = 0; j < m_arraySize[1] - 1; j++) {
+						const unsigned char *rows[4];
+						getCellRows(j, k, labelRows, rows);
+						int *rowBricks = &slabBricks[(j >> BrickShift) * m_brickArraySize[0]];
+						int numCells = findRowBoundaryCells(instructionSet, rows, rowCells.data());
+						for (int idxCell = 0; idxCell < numCells; idxCell++) {
+							int i = rowCells[idxCell];
+							unsigned int cellLabels[8];
+							MMCellFlag flag;
+							getCellLabels(rows, i, cellLabels);
+							flag.set(cellLabels);
+							if (flag.vertexType() != MMCellFlag::VertexType::NoVertex) {
+								Vertex vertex = { { i, j, k } };
+								vertices.push_back(vertex);
+								flags.push_back(flag);
+								rowBricks[i >> BrickShift] = 0;
+							}
+						}
+					}
 				}
+				if (m_vertexOrder == VertexOrder::BrickOrder) sortSlabVertices(vertices, flags);
 			}
 		}
+		catch (std::bad_alloc& ba) {
+			isOutOfMemory = true;
+		}
+	});
+	if (isOutOfMemory) {
+		freeMemory();
+		return;
+	}
+
+	// Number vertices and bricks. An exclusive prefix sum over the slab counts gives the
+	// first vertex of each slab, so vertices are numbered in the same order as a serial
+	// scan of the cells (or of the bricks for BrickOrder).
+	size_t numVertices = 0;
+	for (int slab = 0; slab < numSlabs; slab++) {
+		numVertices += slabVertices[slab].size();
+	}
+	if (numVertices > (size_t)maxNumVertices) {
+		freeMemory();
+		return;
+	}
+	m_numVertices = (int)numVertices;
+	m_numBricks = 0;
+	for (int idxBrick = 0; idxBrick < numBricks; idxBrick++) {
+		if (m_brickIndices[idxBrick] >= 0) m_brickIndices[idxBrick] = m_numBricks++;
 	}
 
-	// Create cell vertices. There are no vertices in right, front, top faces.
+	// Create cell vertices and store their indices in their bricks
 	try {
 		if (m_vertices != NULL) delete[] m_vertices;
+		if (m_vertexFlags != NULL) delete[] m_vertexFlags;
+		if (m_vertexOffsets != NULL) delete[] m_vertexOffsets;
+		m_vertices = NULL;
+		m_vertexFlags = NULL;
+		m_vertexOffsets = NULL;
 		m_vertices = new Vertex[m_numVertices];
+		m_vertexFlags = new MMCellFlag[m_numVertices];
+		m_vertexOffsets = new float[3 * m_numVertices];
+		m_brickVertexIndices = new int[(size_t)m_numBricks * BrickCells];
 	}
 	catch (std::bad_alloc& ba) {
-		delete[] m_cellArray;
-		m_cellArray = NULL;
-		m_numVertices = 0;
-		m_vertices = NULL;
+		freeMemory();
 		return;
 	}
-	int idxVtx = 0;
-	for (int k = 0; k < m_arraySize[2] - 1; k++) {
-		for (int j = 0; j < m_arraySize[1] - 1; j++) {
-			for (int i = 0; i < m_arraySize[0] - 1; i++) {
-				Cell* pCell = getCell(i, j, k);
-				if (pCell->flag.vertexType() != MMCellFlag::VertexType::NoVertex) {
-					pCell->vertexIndex = idxVtx;
-					Vertex *pVtx = &m_vertices[idxVtx++];
-					pVtx->cellIndex[0] = i;
-					pVtx->cellIndex[1] = j;
-					pVtx->cellIndex[2] = k;
+	std::vector<int> slabFirstVertex(numSlabs + 1, 0);
+	for (int slab = 0; slab < numSlabs; slab++) {
+		slabFirstVertex[slab + 1] = slabFirstVertex[slab] + (int)slabVertices[slab].size();
+	}
+	std::fill(m_brickVertexIndices, m_brickVertexIndices + (size_t)m_numBricks * BrickCells, -1);
+	MMParallel::forRange(0, numSlabs, numThreads, [&](int beginSlab, int endSlab) {
+		for (int slab = beginSlab; slab < endSlab; slab++) {
+			int idxVtx = slabFirstVertex[slab];
+			std::vector<Vertex> &vertices = slabVertices[slab];
+			std::copy(vertices.begin(), vertices.end(), &m_vertices[idxVtx]);
+			std::copy(slabFlags[slab].begin(), slabFlags[slab].end(), &m_vertexFlags[idxVtx]);
+			for (size_t idx = 0; idx < vertices.size(); idx++, idxVtx++) {
+				int *cellIndex = vertices[idx].cellIndex;
+				m_brickVertexIndices[brickCellArrayIndex(cellIndex[0], cellIndex[1], cellIndex[2])] = idxVtx;
+			}
+			std::vector<Vertex>().swap(vertices);
+			std::vector<MMCellFlag>().swap(slabFlags[slab]);
+		}
+	});
+	reset();
+	setVertexNeighbors();
+}
+
+// Sort the vertices of a slab of bricks, listed in cell scan order, by brick and in Morton
+// order within each brick. Bricks are ordered as in the brick table. In Morton order, 
+// the bits of the cell's i, j and k offsets in the brick are interleaved, so that most
+// face neighbors in the brick, including those in z, are within a few vertices. Vertices
+// are sorted with two stable counting sorts, first by Morton index and then by brick.
+void MMCellMap::sortSlabVertices(std::vector<Vertex> &vertices, std::vector<MMCellFlag> &flags)
+{
+	// Spread the 3 bits of a brick cell offset to bits 0, 3 and 6
+	static const int spreadBits[BrickSize] = { 0x00, 0x01, 0x08, 0x09, 0x40, 0x41, 0x48, 0x49 };
+	const int mask = BrickSize - 1;
+	int numVertices = (int)vertices.size();
+	int slabSize = m_brickArraySize[0] * m_brickArraySize[1];
+	std::vector<int> brickCells(numVertices);
+	std::vector<int> bricks(numVertices);
+	for (int idx = 0; idx < numVertices; idx++) {
+		const int *cellIndex = vertices[idx].cellIndex;
+		bricks[idx] = (cellIndex[0] >> BrickShift) + m_brickArraySize[0] * (cellIndex[1] >> BrickShift);
+		brickCells[idx] = spreadBits[cellIndex[0] & mask] | (spreadBits[cellIndex[1] & mask] << 1) | 
+			(spreadBits[cellIndex[2] & mask] << 2);
+	}
+	std::vector<int> order(numVertices);
+	std::vector<int> sortedOrder(numVertices);
+	std::vector<int> counts(std::max((int)BrickCells, slabSize) + 1);
+	for (int pass = 0; pass < 2; pass++) {
+		const std::vector<int> &keys = (pass == 0) ? brickCells : bricks;
+		int numKeys = (pass == 0) ? BrickCells : slabSize;
+		std::fill(counts.begin(), counts.begin() + numKeys + 1, 0);
+		for (int idx = 0; idx < numVertices; idx++) counts[keys[idx] + 1]++;
+		for (int key = 0; key < numKeys; key++) counts[key + 1] += counts[key];
+		for (int idx = 0; idx < numVertices; idx++) {
+			int idxSrc = (pass == 0) ? idx : order[idx];
+			sortedOrder[counts[keys[idxSrc]]++] = idxSrc;
+		}
+		order.swap(sortedOrder);
+	}
+	std::vector<Vertex> sortedVertices(numVertices);
+	std::vector<MMCellFlag> sortedFlags(numVertices);
+	for (int idx = 0; idx < numVertices; idx++) {
+		sortedVertices[idx] = vertices[order[idx]];
+		sortedFlags[idx] = flags[order[idx]];
+	}
+	vertices.swap(sortedVertices);
+	flags.swap(sortedFlags);
+}
+
+// Build the vertex neighbor graph used for relaxation. Surface vertices are connected
+// to vertices in cells across each face crossing. Edge and corner vertices are only
+// connected across junction face crossings so that sharp edges and corners are 
+// preserved.
+void MMCellMap::setVertexNeighbors()
+{
+	try {
+		m_nbrBegin = new int[m_numVertices + 1];
+		m_nbrCellDeltaSums = new float[3 * m_numVertices];
+	}
+	catch (std::bad_alloc& ba) {
+		freeMemory();
+		return;
+	}
+
+	// Count neighbors in parallel and convert counts to offsets
+	int numThreads = MMParallel::numThreads(0);
+	MMParallel::forRange(0, m_numVertices, numThreads, [&](int begin, int end) {
+		for (int idxVtx = begin; idxVtx < end; idxVtx++) {
+			MMCellFlag flag = m_vertexFlags[idxVtx];
+			bool isSurfaceVertex = (flag.vertexType() == MMCellFlag::VertexType::SurfaceVertex);
+			int numNeighbors = 0;
+			for (MMCellFlag::Face face = MMCellFlag::Face::LeftFace; face <= MMCellFlag::Face::TopFace; ++face) {
+				MMCellFlag::FaceCrossingType crossingType = flag.faceCrossingType(face);
+				if ((isSurfaceVertex && crossingType != MMCellFlag::FaceCrossingType::NoFaceCrossing) ||
+					crossingType == MMCellFlag::FaceCrossingType::JunctionFaceCrossing) {
+					numNeighbors++;
 				}
 			}
+			m_nbrBegin[idxVtx + 1] = numNeighbors;
 		}
+	});
+	m_nbrBegin[0] = 0;
+	for (int idxVtx = 0; idxVtx < m_numVertices; idxVtx++) {
+		m_nbrBegin[idxVtx + 1] += m_nbrBegin[idxVtx];
+	}
+	try {
+		m_nbrIndices = new int[m_nbrBegin[m_numVertices]];
 	}
+	catch (std::bad_alloc& ba) {
+		freeMemory();
+		return;
+	}
+
+	// Store neighbors in face order
+	MMParallel::forRange(0, m_numVertices, numThreads, [&](int begin, int end) {
+		for (int idxVtx = begin; idxVtx < end; idxVtx++) {
+			int cellIdx[3];
+			getVertexCellIndex(idxVtx, cellIdx);
+			MMCellFlag flag = m_vertexFlags[idxVtx];
+			bool isSurfaceVertex = (flag.vertexType() == MMCellFlag::VertexType::SurfaceVertex);
+			int *pNbr = &m_nbrIndices[m_nbrBegin[idxVtx]];
+			float *deltaSum = &m_nbrCellDeltaSums[3 * idxVtx];
+			deltaSum[0] = deltaSum[1] = deltaSum[2] = 0.0f;
+			for (MMCellFlag::Face face = MMCellFlag::Face::LeftFace; face <= MMCellFlag::Face::TopFace; ++face) {
+				MMCellFlag::FaceCrossingType crossingType = flag.faceCrossingType(face);
+				if ((isSurfaceVertex && crossingType != MMCellFlag::FaceCrossingType::NoFaceCrossing) ||
+					crossingType == MMCellFlag::FaceCrossingType::JunctionFaceCrossing) {
+					int nbrIdx[3];
+					getFaceNeighborCellIndex(cellIdx, face, nbrIdx);
+					*pNbr++ = cellVertexIndex(nbrIdx[0], nbrIdx[1], nbrIdx[2]);
+					deltaSum[0] += (float)(nbrIdx[0] - cellIdx[0]);
+					deltaSum[1] += (float)(nbrIdx[1] - cellIdx[1]);
+					deltaSum[2] += (float)(nbrIdx[2] - cellIdx[2]);
+				}
+			}
+		}
+	});
 }
 
-// The caller is responsible for bounds checking to allow for optimal performance.
-void MMCellMap::getEdgeLabels(int cellIndex[3], MMCellFlag::Edge edge, unsigned short quadLabels[2])
+// Add runs of equal labels in a row of labels of type Label to stats
+template <typename Label>
+static void addRowVoxels(const unsigned char *labelRow, int rowLength, int j, int k, 
+	MMLabelStats &stats)
+{
+	const Label *row = (const Label *)labelRow;
+	int begin = 0;
+	for (int i = 1; i <= rowLength; i++) {
+		if (i == rowLength || row[i] != row[begin]) {
+			stats.addVoxels(row[begin], begin, i, j, k);
+			begin = i;
+		}
+	}
+}
+
+// Compute label statistics in two parallel passes, over the label rows for voxel counts
+// and bounding boxes and over the vertices for quad counts. Quads are counted for the 
+// 3 edges per vertex cell that are used for export. Each pass is split into one chunk 
+// per thread and chunks are merged in order. As in setCellVertices(), allocation 
+// failures on the threads are caught and leave the cell map empty.
+void MMCellMap::setLabelStats()
+{
+	int numThreads = MMParallel::numThreads(0);
+	std::vector<MMLabelStats> chunkStats;
+	try {
+		chunkStats.assign(numThreads, MMLabelStats(m_padLabel));
+	}
+	catch (std::bad_alloc& ba) {
+		freeMemory();
+		return;
+	}
+	int rowLength = m_labelArraySize[0];
+	std::atomic<bool> isOutOfMemory(false);
+	MMParallel::forRange(0, numThreads, numThreads, [&](int beginChunk, int endChunk) {
+		try {
+			std::vector<unsigned char> rowBuffer(m_labelBricks ? (size_t)rowLength * m_labelBytes : 0);
+			for (int chunk = beginChunk; chunk < endChunk; chunk++) {
+				MMLabelStats &stats = chunkStats[chunk];
+				int beginK = (int)((long long)m_labelArraySize[2] * chunk / numThreads);
+				int endK = (int)((long long)m_labelArraySize[2] * (chunk + 1) / numThreads);
+				for (int k = beginK; k < endK; k++) {
+					for (int j = 0; j < m_labelArraySize[1]; j++) {
+						const unsigned char *row = getLabelRow(j, k, rowBuffer.data());
+						switch (m_labelType) {
+						case LabelType::UInt8:
+							addRowVoxels<unsigned char>(row, rowLength, j, k, stats);
+							break;
+						case LabelType::UInt32:
+							addRowVoxels<unsigned int>(row, rowLength, j, k, stats);
+							break;
+						default:
+							addRowVoxels<unsigned short>(row, rowLength, j, k, stats);
+							break;
+						}
+					}
+				}
+				int beginVtx = (int)((long long)m_numVertices * chunk / numThreads);
+				int endVtx = (int)((long long)m_numVertices * (chunk + 1) / numThreads);
+				const MMCellFlag::Edge edges[3] = { MMCellFlag::Edge::BackBottomEdge,
+					MMCellFlag::Edge::LeftBottomEdge, MMCellFlag::Edge::LeftBackEdge };
+				for (int idxVtx = beginVtx; idxVtx < endVtx; idxVtx++) {
+					for (int idxEdge = 0; idxEdge < 3; idxEdge++) {
+						if (!m_vertexFlags[idxVtx].isEdgeCrossing(edges[idxEdge])) continue;
+						unsigned int quadLabels[2];
+						getEdgeLabels(m_vertices[idxVtx].cellIndex, edges[idxEdge], quadLabels);
+						stats.addQuad(quadLabels);
+					}
+				}
+			}
+		}
+		catch (std::bad_alloc& ba) {
+			isOutOfMemory = true;
+		}
+	});
+	if (isOutOfMemory) {
+		freeMemory();
+		return;
+	}
+	try {
+		for (int chunk = 1; chunk < numThreads; chunk++) chunkStats[0].merge(chunkStats[chunk]);
+		m_labelStats = chunkStats[0].sortedStats();
+		setLabelIndexTable();
+	}
+	catch (std::bad_alloc& ba) {
+		freeMemory();
+	}
+}
+
+// Make the dense label index table
+void MMCellMap::setLabelIndexTable()
+{
+	if (m_labelStats.empty()) return;
+	size_t tableSize = (size_t)m_labelStats.back().label + 1;
+	if (tableSize > 65536 && tableSize > 16 * m_labelStats.size()) return;
+	m_labelIndexTable.assign(tableSize, -1);
+	for (size_t idxLabel = 0; idxLabel < m_labelStats.size(); idxLabel++) {
+		m_labelIndexTable[m_labelStats[idxLabel].label] = (int)idxLabel;
+	}
+}
+
+// Squared distance between two vertex offsets
+static inline float sqrDisplacement(const float *p0, const float *p1)
+{
+	float d[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	return d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+}
+
+// Displacement of an iteration for the given convergence norm
+static float iterationResidual(MMSurfaceNet::ConvergenceNorm norm, double sumSqrDisp, 
+	float maxSqrDisp, int numVertices)
+{
+	if (norm == MMSurfaceNet::ConvergenceNorm::RMSDisplacement) {
+		return (numVertices > 0) ? (float)sqrt(sumSqrDisp / numVertices) : 0.0f;
+	}
+	return sqrtf(maxSqrDisp);
+}
+
+// Relax vertices in place in vertex order (i.e., Gauss-Seidel relaxation)
+MMSurfaceNet::RelaxStats MMCellMap::relaxSequential(MMSurfaceNet::RelaxAttrs relaxAttrs)
+{
+	MMSurfaceNet::RelaxStats stats = MMSurfaceNet::RelaxStats();
+	if (relaxAttrs.numRelaxIterations <= 0 || m_numVertices == 0) return stats;
+	bool useActiveSet = (relaxAttrs.activeSetEpsilon > 0);
+	ActiveSet activeSet;
+	if (useActiveSet && !initActiveSet(activeSet)) return stats;
+
+	int numVertices = m_numVertices;
+	for (int i = 0; i < relaxAttrs.numRelaxIterations; i++) {
+		if (useActiveSet) numVertices = activeSet.numVertices;
+		double sumSqrDisp = 0.0;
+		float maxSqrDisp = 0.0f;
+		for (int idx = 0; idx < numVertices; idx++) {
+			int idxVtx = useActiveSet ? activeSet.vertices[idx] : idx;
+			float *p = &m_vertexOffsets[3 * idxVtx];
+			float prevP[3] = { p[0], p[1], p[2] };
+			relaxVertex(idxVtx, relaxAttrs, m_vertexOffsets, m_vertexOffsets);
+			float sqrDisp = sqrDisplacement(prevP, p);
+			sumSqrDisp += sqrDisp;
+			if (sqrDisp > maxSqrDisp) maxSqrDisp = sqrDisp;
+			if (useActiveSet) markMovedVertex(activeSet, idx, p, relaxAttrs.activeSetEpsilon);
+		}
+		stats.numIterations++;
+		stats.activeSetSizes.push_back(numVertices);
+		stats.residual = iterationResidual(relaxAttrs.convergenceNorm, sumSqrDisp, maxSqrDisp, 
+			m_numVertices);
+		if (stats.residual < relaxAttrs.convergenceTolerance) break;
+		if (useActiveSet && updateActiveSet(activeSet) == 0) break;
+	}
+	if (useActiveSet) freeActiveSet(activeSet);
+	return stats;
+}
+
+// Relax all vertices from the positions of the previous iteration (i.e., Jacobi
+// relaxation) using double-buffered vertex offsets. Because each vertex only reads
+// the previous iteration, vertices can be relaxed in any order and the work is 
+// split across threads without changing the result. Vertex displacements are summed
+// in fixed-size blocks of vertices and block sums are combined in order so that the
+// residual is also independent of the number of threads.
+//
+// With an active set, only listed vertices are relaxed. Their new offsets are copied 
+// back to m_vertexOffsets after each iteration, so m_vertexOffsets always holds the 
+// offsets of all vertices, while nextOffsets only holds valid offsets for the vertices
+// listed in the iteration that wrote them. Offsets are only ever read from 
+// m_vertexOffsets.
+MMSurfaceNet::RelaxStats MMCellMap::relaxJacobi(MMSurfaceNet::RelaxAttrs relaxAttrs)
+{
+	MMSurfaceNet::RelaxStats stats = MMSurfaceNet::RelaxStats();
+	if (relaxAttrs.numRelaxIterations <= 0 || m_numVertices == 0) return stats;
+	const int blockSize = 4096;
+	int numBlocks = (m_numVertices + blockSize - 1) / blockSize;
+	float *nextOffsets = NULL;
+	double *blockSumSqrDisp = NULL;
+	float *blockMaxSqrDisp = NULL;
+	try {
+		nextOffsets = new float[3 * m_numVertices];
+		blockSumSqrDisp = new double[numBlocks];
+		blockMaxSqrDisp = new float[numBlocks];
+	}
+	catch (std::bad_alloc& ba) {
+		if (nextOffsets) delete[] nextOffsets;
+		if (blockSumSqrDisp) delete[] blockSumSqrDisp;
+		return stats;
+	}
+	bool useActiveSet = (relaxAttrs.activeSetEpsilon > 0);
+	ActiveSet activeSet;
+	if (useActiveSet && !initActiveSet(activeSet)) {
+		delete[] nextOffsets;
+		delete[] blockSumSqrDisp;
+		delete[] blockMaxSqrDisp;
+		return stats;
+	}
+
+	// Each thread relaxes a contiguous range of vertex blocks with the fastest 
+	// available instruction set. Threads are started once for all iterations.
+	MMParallel::ThreadPool threadPool(MMParallel::numThreads(relaxAttrs.numThreads));
+	MMRelaxKernel::InstructionSet instructionSet = MMRelaxKernel::bestInstructionSet();
+	MMRelaxKernel::VertexData vertexData = { m_nbrBegin, m_nbrIndices, m_nbrCellDeltaSums };
+	int numVertices = m_numVertices;
+	for (int i = 0; i < relaxAttrs.numRelaxIterations; i++) {
+		if (useActiveSet) numVertices = activeSet.numVertices;
+		numBlocks = (numVertices + blockSize - 1) / blockSize;
+		const float *srcOffsets = m_vertexOffsets;
+		float *dstOffsets = nextOffsets;
+		threadPool.forRange(0, numBlocks, [&](int beginBlock, int endBlock) {
+			for (int idxBlock = beginBlock; idxBlock < endBlock; idxBlock++) {
+				int begin = idxBlock * blockSize;
+				int end = std::min(begin + blockSize, numVertices);
+				if (useActiveSet) {
+					MMRelaxKernel::relaxList(instructionSet, vertexData, &activeSet.vertices[begin], 
+						end - begin, relaxAttrs.relaxFactor, relaxAttrs.maxDistFromCellCenter, 
+						srcOffsets, dstOffsets);
+				}
+				else {
+					MMRelaxKernel::relax(instructionSet, vertexData, begin, end, relaxAttrs.relaxFactor,
+						relaxAttrs.maxDistFromCellCenter, srcOffsets, dstOffsets);
+				}
+				double sumSqrDisp = 0.0;
+				float maxSqrDisp = 0.0f;
+				for (int idx = begin; idx < end; idx++) {
+					int idxVtx = useActiveSet ? activeSet.vertices[idx] : idx;
+					float sqrDisp = sqrDisplacement(&srcOffsets[3 * idxVtx], &dstOffsets[3 * idxVtx]);
+					sumSqrDisp += sqrDisp;
+					if (sqrDisp > maxSqrDisp) maxSqrDisp = sqrDisp;
+					if (useActiveSet) {
+						markMovedVertex(activeSet, idx, &dstOffsets[3 * idxVtx], 
+							relaxAttrs.activeSetEpsilon);
+					}
+				}
+				blockSumSqrDisp[idxBlock] = sumSqrDisp;
+				blockMaxSqrDisp[idxBlock] = maxSqrDisp;
+			}
+		});
+		if (useActiveSet) {
+			threadPool.forRange(0, numVertices, [&](int begin, int end) {
+				for (int idx = begin; idx < end; idx++) {
+					int idxVtx = activeSet.vertices[idx];
+					m_vertexOffsets[3 * idxVtx + 0] = nextOffsets[3 * idxVtx + 0];
+					m_vertexOffsets[3 * idxVtx + 1] = nextOffsets[3 * idxVtx + 1];
+					m_vertexOffsets[3 * idxVtx + 2] = nextOffsets[3 * idxVtx + 2];
+				}
+			});
+		}
+		else {
+			std::swap(m_vertexOffsets, nextOffsets);
+		}
+
+		double sumSqrDisp = 0.0;
+		float maxSqrDisp = 0.0f;
+		for (int idxBlock = 0; idxBlock < numBlocks; idxBlock++) {
+			sumSqrDisp += blockSumSqrDisp[idxBlock];
+			if (blockMaxSqrDisp[idxBlock] > maxSqrDisp) maxSqrDisp = blockMaxSqrDisp[idxBlock];
+		}
+		stats.numIterations++;
+		stats.activeSetSizes.push_back(numVertices);
+		stats.residual = iterationResidual(relaxAttrs.convergenceNorm, sumSqrDisp, maxSqrDisp, 
+			m_numVertices);
+		if (stats.residual < relaxAttrs.convergenceTolerance) break;
+		if (useActiveSet && updateActiveSet(activeSet) == 0) break;
+	}
+	delete[] nextOffsets;
+	delete[] blockSumSqrDisp;
+	delete[] blockMaxSqrDisp;
+	if (useActiveSet) freeActiveSet(activeSet);
+	return stats;
+}
+
+// Initialize the active set to all vertices. A vertex's relaxation reads its neighbors,
+// so when a vertex moves, the vertices that list it as a neighbor must be relaxed. The
+// neighbor graph is not symmetric (edge and corner vertices ignore surface vertices),
+// so these dependent vertices are stored in a transposed copy of the neighbor graph.
+bool MMCellMap::initActiveSet(ActiveSet &activeSet)
+{
+	activeSet.numVertices = m_numVertices;
+	activeSet.vertices = NULL;
+	activeSet.nextVertices = NULL;
+	activeSet.hasMoved = NULL;
+	activeSet.isActive = NULL;
+	activeSet.movedOffsets = NULL;
+	activeSet.dependentBegin = NULL;
+	activeSet.dependentIndices = NULL;
+	try {
+		activeSet.vertices = new int[m_numVertices + 1];
+		activeSet.nextVertices = new int[m_numVertices + 1];
+		activeSet.hasMoved = new unsigned char[m_numVertices];
+		activeSet.isActive = new unsigned char[m_numVertices];
+		activeSet.movedOffsets = new float[3 * m_numVertices];
+		activeSet.dependentBegin = new int[m_numVertices + 1];
+		activeSet.dependentIndices = new int[m_nbrBegin[m_numVertices]];
+	}
+	catch (std::bad_alloc& ba) {
+		freeActiveSet(activeSet);
+		return false;
+	}
+	for (int idxVtx = 0; idxVtx < m_numVertices; idxVtx++) activeSet.vertices[idxVtx] = idxVtx;
+	std::fill(activeSet.isActive, activeSet.isActive + m_numVertices, 0);
+	std::copy(m_vertexOffsets, m_vertexOffsets + 3 * m_numVertices, activeSet.movedOffsets);
+
+	// Count dependents of each vertex, convert counts to offsets and then fill in the 
+	// dependents in vertex order
+	int *dependentBegin = activeSet.dependentBegin;
+	std::fill(dependentBegin, dependentBegin + m_numVertices + 1, 0);
+	for (int idxNbr = 0; idxNbr < m_nbrBegin[m_numVertices]; idxNbr++) {
+		dependentBegin[m_nbrIndices[idxNbr] + 1]++;
+	}
+	for (int idxVtx = 0; idxVtx < m_numVertices; idxVtx++) {
+		dependentBegin[idxVtx + 1] += dependentBegin[idxVtx];
+	}
+	for (int idxVtx = 0; idxVtx < m_numVertices; idxVtx++) {
+		for (int idxNbr = m_nbrBegin[idxVtx]; idxNbr < m_nbrBegin[idxVtx + 1]; idxNbr++) {
+			activeSet.dependentIndices[dependentBegin[m_nbrIndices[idxNbr]]++] = idxVtx;
+		}
+	}
+	for (int idxVtx = m_numVertices; idxVtx > 0; idxVtx--) {
+		dependentBegin[idxVtx] = dependentBegin[idxVtx - 1];
+	}
+	dependentBegin[0] = 0;
+	return true;
+}
+
+void MMCellMap::freeActiveSet(ActiveSet &activeSet)
+{
+	if (activeSet.vertices) delete[] activeSet.vertices;
+	if (activeSet.nextVertices) delete[] activeSet.nextVertices;
+	if (activeSet.hasMoved) delete[] activeSet.hasMoved;
+	if (activeSet.isActive) delete[] activeSet.isActive;
+	if (activeSet.movedOffsets) delete[] activeSet.movedOffsets;
+	if (activeSet.dependentBegin) delete[] activeSet.dependentBegin;
+	if (activeSet.dependentIndices) delete[] activeSet.dependentIndices;
+	activeSet.vertices = NULL;
+	activeSet.nextVertices = NULL;
+	activeSet.hasMoved = NULL;
+	activeSet.isActive = NULL;
+	activeSet.movedOffsets = NULL;
+	activeSet.dependentBegin = NULL;
+	activeSet.dependentIndices = NULL;
+}
+
+// Mark the vertex at position idx in the active set as moved if its new offset p is 
+// more than epsilon from where it was last marked. Comparing against the last marked 
+// position rather than the previous iteration means that slow drift eventually wakes 
+// up dependents.
+void MMCellMap::markMovedVertex(ActiveSet &activeSet, int idx, const float *p, float epsilon)
+{
+	int idxVtx = activeSet.vertices[idx];
+	float *movedP = &activeSet.movedOffsets[3 * idxVtx];
+	if (sqrDisplacement(movedP, p) > epsilon * epsilon) {
+		movedP[0] = p[0];
+		movedP[1] = p[1];
+		movedP[2] = p[2];
+		activeSet.hasMoved[idx] = 1;
+	}
+	else {
+		activeSet.hasMoved[idx] = 0;
+	}
+}
+
+// Replace the active set with the vertices that were marked as moved in the last 
+// iteration and their dependents, in vertex order. Returns the new active set size.
+// Work is proportional to the size of the old and new sets rather than the number
+// of vertices: new vertices are marked and collected as they are found and then put
+// in vertex order, by sorting when the set is small relative to the range of vertices
+// it spans and otherwise by scanning the marks over that range.
+int MMCellMap::updateActiveSet(ActiveSet &activeSet)
+{
+	unsigned char *isActive = activeSet.isActive;
+	int *nextVertices = activeSet.nextVertices;
+	int numVertices = 0;
+	int minVtx = m_numVertices;
+	int maxVtx = -1;
+	for (int idx = 0; idx < activeSet.numVertices; idx++) {
+		if (!activeSet.hasMoved[idx]) continue;
+		int idxVtx = activeSet.vertices[idx];
+		int *dependents = &activeSet.dependentIndices[activeSet.dependentBegin[idxVtx]];
+		int numDependents = activeSet.dependentBegin[idxVtx + 1] - activeSet.dependentBegin[idxVtx];
+		for (int idxDep = -1; idxDep < numDependents; idxDep++) {
+			// Append vertices that are not yet marked without branching on isActive, 
+			// which is unpredictable. Every vertex is written before it is checked, so
+			// once all vertices are marked the write goes to the spare last entry.
+			int vtx = (idxDep < 0) ? idxVtx : dependents[idxDep];
+			nextVertices[numVertices] = vtx;
+			numVertices += 1 - isActive[vtx];
+			isActive[vtx] = 1;
+			minVtx = std::min(minVtx, vtx);
+			maxVtx = std::max(maxVtx, vtx);
+		}
+	}
+
+	// Put the new active set in vertex order and clear the marks
+	if ((long long)numVertices * 16 < (long long)maxVtx - minVtx + 1) {
+		std::sort(nextVertices, nextVertices + numVertices);
+		for (int idx = 0; idx < numVertices; idx++) isActive[nextVertices[idx]] = 0;
+	}
+	else {
+		// Compact without branching on isActive, which is unpredictable
+		int idx = 0;
+		for (int idxVtx = minVtx; idxVtx <= maxVtx; idxVtx++) {
+			nextVertices[idx] = idxVtx;
+			idx += isActive[idxVtx];
+			isActive[idxVtx] = 0;
+		}
+	}
+	std::swap(activeSet.vertices, activeSet.nextVertices);
+	activeSet.numVertices = numVertices;
+	return numVertices;
+}
+
+// Move a vertex towards the average position of its neighbors. Offsets are read from
+// srcOffsets and the relaxed offset is written to dstOffsets, which may be the same 
+// array for in-place relaxation.
+void MMCellMap::relaxVertex(int idxVtx, MMSurfaceNet::RelaxAttrs relaxAttrs, 
+	const float *srcOffsets, float *dstOffsets)
+{
+	const float *p = &srcOffsets[3 * idxVtx];
+	float *relaxedP = &dstOffsets[3 * idxVtx];
+	int nbrBegin = m_nbrBegin[idxVtx];
+	int numNeighbors = m_nbrBegin[idxVtx + 1] - nbrBegin;
+	if (numNeighbors == 0) {
+		if (relaxedP != p) {
+			relaxedP[0] = p[0];
+			relaxedP[1] = p[1];
+			relaxedP[2] = p[2];
+		}
+		return;
+	}
+
+	// Average neighbor positions in the vertex's cell coordinates
+	const int *pNbr = &m_nbrIndices[nbrBegin];
+	const float *deltaSum = &m_nbrCellDeltaSums[3 * idxVtx];
+	float avgP[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < numNeighbors; i++) {
+		const float *nbrP = &srcOffsets[3 * pNbr[i]];
+		avgP[0] += nbrP[0];
+		avgP[1] += nbrP[1];
+		avgP[2] += nbrP[2];
+	}
+	avgP[0] = (avgP[0] + deltaSum[0]) / (float)numNeighbors;
+	avgP[1] = (avgP[1] + deltaSum[1]) / (float)numNeighbors;
+	avgP[2] = (avgP[2] + deltaSum[2]) / (float)numNeighbors;
+
+	// Add a fraction of the averaged vertex position to the current position
+	float alpha = relaxAttrs.relaxFactor;
+	relaxedP[0] = (1.0 - alpha) * p[0] + alpha * avgP[0];
+	relaxedP[1] = (1.0 - alpha) * p[1] + alpha * avgP[1];
+	relaxedP[2] = (1.0 - alpha) * p[2] + alpha * avgP[2];
+
+	// Constrain vertex location to a max distance from the original voxel
+	float min = 0.5 - relaxAttrs.maxDistFromCellCenter;
+	float max = 0.5 + relaxAttrs.maxDistFromCellCenter;
+	if (relaxedP[0] < min) relaxedP[0] = min;
+	if (relaxedP[0] > max) relaxedP[0] = max;
+	if (relaxedP[1] < min) relaxedP[1] = min;
+	if (relaxedP[1] > max) relaxedP[1] = max;
+	if (relaxedP[2] < min) relaxedP[2] = min;
+	if (relaxedP[2] > max) relaxedP[2] = max;
+}
+
+void MMCellMap::freeMemory()
 {
-	Cell *pCell = getCell(cellIndex);
-	Cell *pCellFirstLabel;
-	Cell *pCellSecondLabel;
+	if (m_labelCopy) delete[] m_labelCopy;
+	if (m_labelBricks) delete m_labelBricks;
+	if (m_padRow) delete[] m_padRow;
+	if (m_brickIndices) delete[] m_brickIndices;
+	if (m_brickVertexIndices) delete[] m_brickVertexIndices;
+	if (m_vertices) delete[] m_vertices;
+	if (m_vertexFlags) delete[] m_vertexFlags;
+	if (m_vertexOffsets) delete[] m_vertexOffsets;
+	if (m_nbrBegin) delete[] m_nbrBegin;
+	if (m_nbrIndices) delete[] m_nbrIndices;
+	if (m_nbrCellDeltaSums) delete[] m_nbrCellDeltaSums;
+	m_labels = NULL;
+	m_labelCopy = NULL;
+	m_labelBricks = NULL;
+	m_padRow = NULL;
+	m_brickIndices = NULL;
+	m_numBricks = 0;
+	m_brickVertexIndices = NULL;
+	m_numVertices = 0;
+	m_vertices = NULL;
+	m_vertexFlags = NULL;
+	m_vertexOffsets = NULL;
+	m_nbrBegin = NULL;
+	m_nbrIndices = NULL;
+	m_nbrCellDeltaSums = NULL;
+	m_labelStats.clear();
+	m_labelIndexTable.clear();
+}
+
+// The caller is responsible for bounds checking of the cell index. Edge end points 
+// on the padded faces of the cell grid are read as the padding label.
+void MMCellMap::getEdgeLabels(int cellIndex[3], MMCellFlag::Edge edge, unsigned int quadLabels[2])
+{
+	// Offsets of the edge's first and second end points from the cell's left-back-bottom 
+	// corner
+	int first[3] = { 0, 0, 0 };
+	int second[3] = { 0, 0, 0 };
 	switch (edge) {
 	case MMCellFlag::Edge::LeftBottomEdge:
-		pCellFirstLabel = pCell;
-		pCellSecondLabel = pCell + m_arraySize[0];
+		second[1] = 1;
 		break;
 	case MMCellFlag::Edge::RightBottomEdge:
-		pCellFirstLabel = pCell + 1;
-		pCellSecondLabel = pCell + 1 + m_arraySize[0];
+		first[0] = 1;
+		second[0] = 1; second[1] = 1;
 		break;
 	case MMCellFlag::Edge::BackBottomEdge:
-		pCellFirstLabel = pCell;
-		pCellSecondLabel = pCell + 1;
+		second[0] = 1;
 		break;
 	case MMCellFlag::Edge::FrontBottomEdge:
-		pCellFirstLabel = pCell + m_arraySize[0];
-		pCellSecondLabel = pCell + 1 + m_arraySize[0];
+		first[1] = 1;
+		second[0] = 1; second[1] = 1;
 		break;
 	case MMCellFlag::Edge::LeftTopEdge:
-		pCellFirstLabel = pCell + m_arraySize[0] * m_arraySize[1];
-		pCellSecondLabel = pCell + m_arraySize[0] + m_arraySize[0] * m_arraySize[1];
+		first[2] = 1;
+		second[1] = 1; second[2] = 1;
 		break;
 	case MMCellFlag::Edge::RightTopEdge:
-		pCellFirstLabel = pCell + 1 + m_arraySize[0] * m_arraySize[1];
-		pCellSecondLabel = pCell + 1 + m_arraySize[0] + m_arraySize[0] * m_arraySize[1];
+		first[0] = 1; first[2] = 1;
+		second[0] = 1; second[1] = 1; second[2] = 1;
 		break;
 	case MMCellFlag::Edge::BackTopEdge:
-		pCellFirstLabel = pCell + m_arraySize[0] * m_arraySize[1];
-		pCellSecondLabel = pCell + 1 + m_arraySize[0] * m_arraySize[1];
+		first[2] = 1;
+		second[0] = 1; second[2] = 1;
 		break;
 	case MMCellFlag::Edge::FrontTopEdge:
-		pCellFirstLabel = pCell + m_arraySize[0] + m_arraySize[0] * m_arraySize[1];
-		pCellSecondLabel = pCell + 1 + m_arraySize[0] + m_arraySize[0] * m_arraySize[1];
+		first[1] = 1; first[2] = 1;
+		second[0] = 1; second[1] = 1; second[2] = 1;
 		break;
 	case MMCellFlag::Edge::LeftBackEdge:
-		pCellFirstLabel = pCell;
-		pCellSecondLabel = pCell + m_arraySize[0] * m_arraySize[1];
+		second[2] = 1;
 		break;
 	case MMCellFlag::Edge::RightBackEdge:
-		pCellFirstLabel = pCell + 1;
-		pCellSecondLabel = pCell + 1 + m_arraySize[0] * m_arraySize[1];
+		first[0] = 1;
+		second[0] = 1; second[2] = 1;
 		break;
 	case MMCellFlag::Edge::LeftFrontEdge:
-		pCellFirstLabel = pCell + m_arraySize[0];
-		pCellSecondLabel = pCell + m_arraySize[0] + m_arraySize[0] * m_arraySize[1];
+		first[1] = 1;
+		second[1] = 1; second[2] = 1;
 		break;
 	case MMCellFlag::Edge::RightFrontEdge:
-		pCellFirstLabel = pCell + 1 + m_arraySize[0];
-		pCellSecondLabel = pCell + 1 + m_arraySize[0] + m_arraySize[0] * m_arraySize[1];
+		first[0] = 1; first[1] = 1;
+		second[0] = 1; second[1] = 1; second[2] = 1;
 		break;
 	default:
-		pCellFirstLabel = pCell;
-		pCellSecondLabel = pCell;
 		break;
 	}
-	quadLabels[0] = pCellFirstLabel->label;
-	quadLabels[1] = pCellSecondLabel->label; 
+	quadLabels[0] = label(cellIndex[0] + first[0], cellIndex[1] + first[1], cellIndex[2] + first[2]);
+	quadLabels[1] = label(cellIndex[0] + second[0], cellIndex[1] + second[1], cellIndex[2] + second[2]);
 }
 
 // The caller is responsible for bounds checking to allow for optimal performance.
@@ -350,9 +1066,7 @@ void MMCellMap::getEdgeQuadPositions(int cellIndex[3], MMCellFlag::Edge edge, fl
 	int vtxIndices[4] = { 0, 0, 0, 0 };
 	getEdgeQuadVtxIndices(cellIndex, edge, vtxIndices);
 	for (int i = 0; i < 4; i++) {
-		int cellIndex[3];
-		getVertexCellIndex(vtxIndices[i], cellIndex);
-		getVertexPosition(cellIndex, &(quadCorners[i * 3]));
+		getVertexPosition(vtxIndices[i], &(quadCorners[i * 3]));
 	}
 }
 // The caller is responsible for bounds checking to allow for optimal performance.
@@ -361,123 +1075,259 @@ void MMCellMap::getEdgeQuadPositions(int cellIndex[3], MMCellFlag::Edge edge, fl
 void MMCellMap::getEdgeQuadVtxIndices(int cellIndex[3], MMCellFlag::Edge edge,
 	int quadVtxIndices[4])
 {
-	Cell* pCell = getCell(cellIndex);
-	int length = m_arraySize[0];
-	int area = m_arraySize[0] * m_arraySize[1];
-	quadVtxIndices[0] = pCell->vertexIndex;
+	int i = cellIndex[0];
+	int j = cellIndex[1];
+	int k = cellIndex[2];
+	quadVtxIndices[0] = cellVertexIndex(i, j, k);
 	switch (edge) {
 		case MMCellFlag::Edge::LeftBottomEdge:
-			quadVtxIndices[1] = (pCell - area)->vertexIndex;
-			quadVtxIndices[2] = (pCell - 1 - area)->vertexIndex;
-			quadVtxIndices[3] = (pCell - 1)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i, j, k - 1);
+			quadVtxIndices[2] = cellVertexIndex(i - 1, j, k - 1);
+			quadVtxIndices[3] = cellVertexIndex(i - 1, j, k);
 			break;
 		case MMCellFlag::Edge::RightBottomEdge:
-			quadVtxIndices[1] = (pCell + 1)->vertexIndex;
-			quadVtxIndices[2] = (pCell + 1 - area)->vertexIndex;
-			quadVtxIndices[3] = (pCell - area)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i + 1, j, k);
+			quadVtxIndices[2] = cellVertexIndex(i + 1, j, k - 1);
+			quadVtxIndices[3] = cellVertexIndex(i, j, k - 1);
 			break;
 		case MMCellFlag::Edge::BackBottomEdge:
-			quadVtxIndices[1] = (pCell - length)->vertexIndex;
-			quadVtxIndices[2] = (pCell - length - area)->vertexIndex;
-			quadVtxIndices[3] = (pCell - area)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i, j - 1, k);
+			quadVtxIndices[2] = cellVertexIndex(i, j - 1, k - 1);
+			quadVtxIndices[3] = cellVertexIndex(i, j, k - 1);
 			break;
 		case MMCellFlag::Edge::FrontBottomEdge:
-			quadVtxIndices[1] = (pCell - area)->vertexIndex;
-			quadVtxIndices[2] = (pCell + length - area)->vertexIndex;
-			quadVtxIndices[3] = (pCell + length)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i, j, k - 1);
+			quadVtxIndices[2] = cellVertexIndex(i, j + 1, k - 1);
+			quadVtxIndices[3] = cellVertexIndex(i, j + 1, k);
 			break;
 		case MMCellFlag::Edge::LeftTopEdge:
-			quadVtxIndices[1] = (pCell - 1)->vertexIndex;
-			quadVtxIndices[2] = (pCell - 1 + area)->vertexIndex;
-			quadVtxIndices[3] = (pCell + area)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i - 1, j, k);
+			quadVtxIndices[2] = cellVertexIndex(i - 1, j, k + 1);
+			quadVtxIndices[3] = cellVertexIndex(i, j, k + 1);
 			break;
 		case MMCellFlag::Edge::RightTopEdge:
-			quadVtxIndices[1] = (pCell + area)->vertexIndex;
-			quadVtxIndices[2] = (pCell + 1 + area)->vertexIndex;
-			quadVtxIndices[3] = (pCell + 1)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i, j, k + 1);
+			quadVtxIndices[2] = cellVertexIndex(i + 1, j, k + 1);
+			quadVtxIndices[3] = cellVertexIndex(i + 1, j, k);
 			break;
 		case MMCellFlag::Edge::BackTopEdge:
-			quadVtxIndices[1] = (pCell + area)->vertexIndex;
-			quadVtxIndices[2] = (pCell - length + area)->vertexIndex;
-			quadVtxIndices[3] = (pCell - length)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i, j, k + 1);
+			quadVtxIndices[2] = cellVertexIndex(i, j - 1, k + 1);
+			quadVtxIndices[3] = cellVertexIndex(i, j - 1, k);
 			break;
 		case MMCellFlag::Edge::FrontTopEdge:
-			quadVtxIndices[1] = (pCell + length)->vertexIndex;
-			quadVtxIndices[2] = (pCell + length + area)->vertexIndex;
-			quadVtxIndices[3] = (pCell + area)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i, j + 1, k);
+			quadVtxIndices[2] = cellVertexIndex(i, j + 1, k + 1);
+			quadVtxIndices[3] = cellVertexIndex(i, j, k + 1);
 			break;
 		case MMCellFlag::Edge::LeftBackEdge:
-			quadVtxIndices[1] = (pCell - 1)->vertexIndex;
-			quadVtxIndices[2] = (pCell - 1 - length)->vertexIndex;
-			quadVtxIndices[3] = (pCell - length)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i - 1, j, k);
+			quadVtxIndices[2] = cellVertexIndex(i - 1, j - 1, k);
+			quadVtxIndices[3] = cellVertexIndex(i, j - 1, k);
 			break;
 		case MMCellFlag::Edge::RightBackEdge:
-			quadVtxIndices[1] = (pCell - length)->vertexIndex;
-			quadVtxIndices[2] = (pCell + 1 - length)->vertexIndex;
-			quadVtxIndices[3] = (pCell + 1)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i, j - 1, k);
+			quadVtxIndices[2] = cellVertexIndex(i + 1, j - 1, k);
+			quadVtxIndices[3] = cellVertexIndex(i + 1, j, k);
 			break;
 		case MMCellFlag::Edge::LeftFrontEdge:
-			quadVtxIndices[1] = (pCell + length)->vertexIndex;
-			quadVtxIndices[2] = (pCell - 1 + length)->vertexIndex;
-			quadVtxIndices[3] = (pCell - 1)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i, j + 1, k);
+			quadVtxIndices[2] = cellVertexIndex(i - 1, j + 1, k);
+			quadVtxIndices[3] = cellVertexIndex(i - 1, j, k);
 			break;
 		case MMCellFlag::Edge::RightFrontEdge:
-			quadVtxIndices[1] = (pCell + 1)->vertexIndex;
-			quadVtxIndices[2] = (pCell + 1 + length)->vertexIndex;
-			quadVtxIndices[3] = (pCell + length)->vertexIndex;
+			quadVtxIndices[1] = cellVertexIndex(i + 1, j, k);
+			quadVtxIndices[2] = cellVertexIndex(i + 1, j + 1, k);
+			quadVtxIndices[3] = cellVertexIndex(i, j + 1, k);
 			break;
 		default:
-			quadVtxIndices[1] = (pCell)->vertexIndex;
-			quadVtxIndices[2] = (pCell)->vertexIndex;
-			quadVtxIndices[3] = (pCell)->vertexIndex;
+			quadVtxIndices[1] = quadVtxIndices[0];
+			quadVtxIndices[2] = quadVtxIndices[0];
+			quadVtxIndices[3] = quadVtxIndices[0];
 			break;
 	}
 }
 
 
 // Access cell map. The caller is responsible for bounds checking.
-MMCellMap::Cell *MMCellMap::getCell(int cellIndex[3])
+size_t MMCellMap::brickCellArrayIndex(int i, int j, int k)
 {
-	return(&(m_cellArray[cellArrayIndex(cellIndex)]));
+	int brick = m_brickIndices[(i >> BrickShift) + m_brickArraySize[0] * ((j >> BrickShift) + 
+		m_brickArraySize[1] * (k >> BrickShift))];
+	int brickCell = (i & (BrickSize - 1)) + BrickSize * ((j & (BrickSize - 1)) + BrickSize * (k & (BrickSize - 1)));
+	return (size_t)brick * BrickCells + brickCell;
 }
-MMCellMap::Cell *MMCellMap::getCell(int i, int j, int k)
+// Index of the vertex of cell (i, j, k), or -1 if the cell has no vertex
+int MMCellMap::cellVertexIndex(int i, int j, int k)
 {
-	return(&(m_cellArray[cellArrayIndex(i, j, k)]));
+	int brick = m_brickIndices[(i >> BrickShift) + m_brickArraySize[0] * ((j >> BrickShift) + 
+		m_brickArraySize[1] * (k >> BrickShift))];
+	if (brick < 0) return -1;
+	int brickCell = (i & (BrickSize - 1)) + BrickSize * ((j & (BrickSize - 1)) + BrickSize * (k & (BrickSize - 1)));
+	return m_brickVertexIndices[(size_t)brick * BrickCells + brickCell];
 }
-MMCellMap::Cell *MMCellMap::getCell(int cellMapIndex)
+// Label types
+int MMCellMap::labelSize(LabelType labelType)
 {
-	return(&(m_cellArray[cellMapIndex]));
+	switch (labelType) {
+	case LabelType::UInt8:
+		return sizeof(unsigned char);
+	case LabelType::UInt32:
+		return sizeof(unsigned int);
+	default:
+		return sizeof(unsigned short);
+	}
 }
-int MMCellMap::cellArrayIndex(int cellIndex[3])
+unsigned int MMCellMap::paddingLabel(LabelType labelType)
 {
-	return(cellArrayIndex(cellIndex[0], cellIndex[1], cellIndex[2]));
+	switch (labelType) {
+	case LabelType::UInt8:
+		return std::numeric_limits<unsigned char>::max();
+	case LabelType::UInt32:
+		return std::numeric_limits<unsigned int>::max();
+	default:
+		return std::numeric_limits<unsigned short>::max();
+	}
 }
-int MMCellMap::cellArrayIndex(int i, int j, int k)
+unsigned int MMCellMap::paddingLabel()
 {
-	return(i + m_arraySize[0] * j + m_arraySize[0] * m_arraySize[1] * k);
+	return m_padLabel;
 }
-void MMCellMap::getCellLabels(Cell* pCell, unsigned short labels[8])
+
+// Label at the left-back-bottom corner of cell (i, j, k) of the padded cell grid
+unsigned int MMCellMap::label(int i, int j, int k)
 {
-	// Labels of cell's 8 corner vertices. This ordering is used when computing cell
-	// flags.
-	labels[0] = pCell->label;
-	labels[1] = (pCell + 1)->label;
-	labels[2] = (pCell + 1 + m_arraySize[0])->label;
-	labels[3] = (pCell + m_arraySize[0])->label;
-	labels[4] = (pCell + m_arraySize[0] * m_arraySize[1])->label;
-	labels[5] = (pCell + 1 + m_arraySize[0] * m_arraySize[1])->label;
-	labels[6] = (pCell + 1 + m_arraySize[0] + m_arraySize[0] * m_arraySize[1])->label;
-	labels[7] = (pCell + m_arraySize[0] + m_arraySize[0] * m_arraySize[1])->label;
+	i--; j--; k--;
+	if (i < 0 || i >= m_labelArraySize[0] || j < 0 || j >= m_labelArraySize[1] || 
+		k < 0 || k >= m_labelArraySize[2]) {
+		return m_padLabel;
+	}
+	if (m_labelBricks) return m_labelBricks->label(i, j, k);
+	size_t labelIndex = i + (size_t)m_labelArraySize[0] * (j + (size_t)m_labelArraySize[1] * k);
+	switch (m_labelType) {
+	case LabelType::UInt8:
+		return m_labels[labelIndex];
+	case LabelType::UInt32:
+		return ((const unsigned int *)m_labels)[labelIndex];
+	default:
+		return ((const unsigned short *)m_labels)[labelIndex];
+	}
 }
-bool MMCellMap::isEdgeCrossing(int cellMapIndex, MMCellFlag::Edge edge)
+// Row of labels (j, k) of the label array. Compressed labels are decoded into rowBuffer,
+// which holds a row of labels.
+const unsigned char *MMCellMap::getLabelRow(int j, int k, unsigned char *rowBuffer)
 {
-	Cell  *pCell = getCell(cellMapIndex);
-	return (pCell->flag.isEdgeCrossing(edge));
+	if (m_labelBricks) {
+		m_labelBricks->decodeRow(j, k, rowBuffer);
+		return rowBuffer;
+	}
+	size_t rowBytes = (size_t)m_labelArraySize[0] * m_labelBytes;
+	return &m_labels[rowBytes * (j + (size_t)m_labelArraySize[1] * k)];
 }
-MMCellFlag::VertexType MMCellMap::cellVertexType(int cellMapIndex)
+// Allocate the buffer for decoded rows of compressed labels
+void MMCellMap::initLabelRows(LabelRows &labelRows)
 {
-	Cell  *pCell = getCell(cellMapIndex);
-	return (pCell->flag.vertexType());
+	if (m_labelBricks) labelRows.buffer.resize(4 * (size_t)m_labelArraySize[0] * m_labelBytes);
+	std::fill(labelRows.rowIndices, labelRows.rowIndices + 4, (size_t)-1);
+}
+// Get the label rows at the corners of the row of cells (j, k) of the padded cell grid, 
+// in the order (j, k), (j + 1, k), (j, k + 1) and (j + 1, k + 1). Rows point into the 
+// label array, or into labelRows for compressed labels, and hold the labels of cells 1
+// to m_arraySize[0] - 2; rows outside the label array point to a row of padding labels.
+void MMCellMap::getCellRows(int j, int k, LabelRows &labelRows, const unsigned char *rows[4])
+{
+	size_t rowBytes = (size_t)m_labelArraySize[0] * m_labelBytes;
+	for (int r = 0; r < 4; r++) {
+		int rowJ = j + (r & 1) - 1;
+		int rowK = k + (r >> 1) - 1;
+		size_t rowIndex = rowJ + (size_t)m_labelArraySize[1] * rowK;
+		if (rowJ < 0 || rowJ >= m_labelArraySize[1] || rowK < 0 || rowK >= m_labelArraySize[2]) {
+			rows[r] = m_padRow;
+		}
+		else if (m_labelBricks) {
+			int slot = (rowJ & 1) + 2 * (rowK & 1);
+			unsigned char *row = &labelRows.buffer[slot * rowBytes];
+			if (labelRows.rowIndices[slot] != rowIndex) {
+				m_labelBricks->decodeRow(rowJ, rowK, row);
+				labelRows.rowIndices[slot] = rowIndex;
+			}
+			rows[r] = row;
+		}
+		else {
+			rows[r] = &m_labels[rowBytes * rowIndex];
+		}
+	}
+}
+// Find cells in a row of cells whose corner labels are not all equal, given the label
+// rows from getCellRows(). Writes their offsets within the row to rowCells and returns
+// their number. The first and last cells have padding labels on one side and are always
+// included. Cells in the last column have no vertices and are not included.
+int MMCellMap::findRowBoundaryCells(MMRelaxKernel::InstructionSet instructionSet, 
+	const unsigned char *rows[4], int *rowCells)
+{
+	int numInteriorCells = m_labelArraySize[0] - 1;
+	int numCells = 0;
+	rowCells[numCells++] = 0;
+	if (numInteriorCells > 0) {
+		int numFound = 0;
+		switch (m_labelType) {
+		case LabelType::UInt8:
+			numFound = MMCellScan::findNonHomogeneousCells(instructionSet, rows, numInteriorCells, 
+				&rowCells[numCells]);
+			break;
+		case LabelType::UInt32:
+			numFound = MMCellScan::findNonHomogeneousCells(instructionSet, (const unsigned int **)rows,
+				numInteriorCells, &rowCells[numCells]);
+			break;
+		default:
+			numFound = MMCellScan::findNonHomogeneousCells(instructionSet, (const unsigned short **)rows,
+				numInteriorCells, &rowCells[numCells]);
+			break;
+		}
+		for (int idxCell = 0; idxCell < numFound; idxCell++) {
+			rowCells[numCells++] += 1;
+		}
+	}
+	rowCells[numCells++] = m_labelArraySize[0];
+	return numCells;
+}
+// Labels of the 8 corners of cell i in a row of cells with labels of type Label. Label 
+// rows start at cell 1 of the padded cell grid, so corners left of cell 1 or right of 
+// the label array are padding.
+template <typename Label>
+static void getRowCellLabels(const unsigned char *labelRows[4], int i, int rowLength, 
+	unsigned int padLabel, unsigned int labels[8])
+{
+	const Label *rows[4];
+	for (int r = 0; r < 4; r++) rows[r] = (const Label *)labelRows[r];
+	int left = i - 1;
+	int right = i;
+	bool hasLeft = (left >= 0);
+	bool hasRight = (right < rowLength);
+	labels[0] = hasLeft ? rows[0][left] : padLabel;
+	labels[1] = hasRight ? rows[0][right] : padLabel;
+	labels[2] = hasRight ? rows[1][right] : padLabel;
+	labels[3] = hasLeft ? rows[1][left] : padLabel;
+	labels[4] = hasLeft ? rows[2][left] : padLabel;
+	labels[5] = hasRight ? rows[2][right] : padLabel;
+	labels[6] = hasRight ? rows[3][right] : padLabel;
+	labels[7] = hasLeft ? rows[3][left] : padLabel;
+}
+// Labels of the 8 corners of cell i in a row of cells, given the label rows from 
+// getCellRows(). This ordering is used when computing cell flags.
+void MMCellMap::getCellLabels(const unsigned char *rows[4], int i, unsigned int labels[8])
+{
+	switch (m_labelType) {
+	case LabelType::UInt8:
+		getRowCellLabels<unsigned char>(rows, i, m_labelArraySize[0], m_padLabel, labels);
+		break;
+	case LabelType::UInt32:
+		getRowCellLabels<unsigned int>(rows, i, m_labelArraySize[0], m_padLabel, labels);
+		break;
+	default:
+		getRowCellLabels<unsigned short>(rows, i, m_labelArraySize[0], m_padLabel, labels);
+		break;
+	}
 }
 
 // Access vertex data
@@ -488,43 +1338,15 @@ void MMCellMap::getVertexCellIndex(int vertexIndex, int cellIndex[3])
 	cellIndex[1] = pVertex->cellIndex[1];
 	cellIndex[2] = pVertex->cellIndex[2];
 }
-void MMCellMap::getVertexPosition(int cellIndex[3], float position[3])
+void MMCellMap::getVertexOffset(int vertexIndex, float offset[3])
 {
-	Cell *pCell = getCell(cellArrayIndex(cellIndex));
-	position[0] = m_voxelSize[0] * (cellIndex[0] + pCell->vertexOffset[0]);
-	position[1] = m_voxelSize[1] * (cellIndex[1] + pCell->vertexOffset[1]);
-	position[2] = m_voxelSize[2] * (cellIndex[2] + pCell->vertexOffset[2]);
-}
-void MMCellMap::getVertexPosition(int i, int j, int k, float position[3])
-{
-	Cell *pCell = getCell(i, j, k);
-	position[0] = m_voxelSize[0] * (i + pCell->vertexOffset[0]);
-	position[1] = m_voxelSize[1] * (j + pCell->vertexOffset[1]);
-	position[2] = m_voxelSize[2] * (k + pCell->vertexOffset[2]);
-}
-int MMCellMap::vertexFaceNeighborVertexIndex(int vertexIndex, MMCellFlag::Face face)
-{
-	int cellMapIndex(cellArrayIndex(m_vertices[vertexIndex].cellIndex));
-	switch (face) {
-	case MMCellFlag::Face::LeftFace:
-		return(cellMapIndex - 1);
-	case MMCellFlag::Face::RightFace:
-		return(cellMapIndex + 1);
-	case MMCellFlag::Face::BackFace:
-		return(cellMapIndex - m_arraySize[0]);
-	case MMCellFlag::Face::FrontFace:
-		return(cellMapIndex + m_arraySize[0]);
-	case MMCellFlag::Face::BottomFace:
-		return(cellMapIndex - m_arraySize[0] * m_arraySize[1]);
-	case MMCellFlag::Face::TopFace:
-		return(cellMapIndex + m_arraySize[0] * m_arraySize[1]);
-	default:
-		return(cellMapIndex);
-	}
+	offset[0] = m_vertexOffsets[3 * vertexIndex + 0];
+	offset[1] = m_vertexOffsets[3 * vertexIndex + 1];
+	offset[2] = m_vertexOffsets[3 * vertexIndex + 2];
 }
 
 // Access cell neighbors
-MMCellMap::Cell *MMCellMap::getFaceNeighborCellAndIndex(int cellIndex[3],
+void MMCellMap::getFaceNeighborCellIndex(int cellIndex[3],
 	MMCellFlag::Face face, int nbrCellIndex[3])
 {
 	nbrCellIndex[0] = cellIndex[0];
@@ -552,5 +1374,4 @@ MMCellMap::Cell *MMCellMap::getFaceNeighborCellAndIndex(int cellIndex[3],
 	default:
 		break;
 	}
-	return (&(m_cellArray[cellArrayIndex(nbrCellIndex)]));
 }
\ No newline at end of file
@@ -7,31 +7,68 @@
 #ifndef MM_CELL_MAP_H
 #define MM_CELL_MAP_H
 
+#include <cstddef>
+#include <climits>
+#include <vector>
+
 #include "MMSurfaceNet.h"
 #include "MMCellFlag.h"
+#include "MMRelaxKernel.h"
+#include "MMLabelBricks.h"
+#include "MMLabelStats.h"
 
 class MMCellMap{
 public:
-	// Basic cell map containing tissue-type labels
-	MMCellMap(unsigned short *labels, int arraySize[3], float voxelSize[3]);
+	// Basic cell map containing tissue-type labels of type labelType, stored according 
+	// to labelStorage. Referenced labels are read from the caller's array for the 
+	// lifetime of the cell map. The padding label is the largest value of the label type.
+	typedef MMSurfaceNet::LabelType LabelType;
+	typedef MMSurfaceNet::LabelStorage LabelStorage;
+	typedef MMSurfaceNet::VertexOrder VertexOrder;
+	MMCellMap(const void *labels, LabelType labelType, int arraySize[3], float voxelSize[3], 
+		LabelStorage labelStorage, VertexOrder vertexOrder);
 	~MMCellMap();
 
+	// False if memory could not be allocated, in which case the cell map is empty
+	bool isValid();
+
 	// Relax vertex positions using relaxation attributes or reset to cell centers
-	void relax(MMSurfaceNet::RelaxAttrs relaxAttrs);
+	MMSurfaceNet::RelaxStats relax(MMSurfaceNet::RelaxAttrs relaxAttrs);
 	void reset();
 
 	// Data for export
 	void getArraySize(int arraySize[3]);
 	void getVoxelSize(float voxelSize[3]);
+	unsigned int paddingLabel();
+	static int labelSize(LabelType labelType);
+	static unsigned int paddingLabel(LabelType labelType);
 	int numVertices();
-	int numEdgeCrossings();
+	size_t numEdgeCrossings();
+	const std::vector<MMSurfaceNet::LabelStats> &labelStats();
+	int labelIndex(unsigned int label);
+	size_t memorySize();
+	size_t labelMemorySize();
 	MMCellFlag::VertexType vertexType(int vertexIndex);
 	bool getEdgeQuad(int vertexIndex, MMCellFlag::Edge edge, float quadCorners[12], 
-		unsigned short quadLabels[2]);
+		unsigned int quadLabels[2]);
 	bool getEdgeQuad(int vertexIndex, MMCellFlag::Edge edge, int quadVtxIndices[4],
-		unsigned short quadLabels[2]);
+		unsigned int quadLabels[2]);
 	void getVertexPosition(int vertexIndex, float position[3]);
 
+	// Edge crossings of a vertex cell and, for an edge with a crossing, the vertex 
+	// indices and labels of its quad as given by getEdgeQuad()
+	bool isEdgeCrossing(int vertexIndex, MMCellFlag::Edge edge);
+	void getQuadVtxIndices(int vertexIndex, MMCellFlag::Edge edge, int quadVtxIndices[4]);
+	void getQuadLabels(int vertexIndex, MMCellFlag::Edge edge, unsigned int quadLabels[2]);
+
+	// Cell index and offset of a vertex within its cell in voxel units
+	void getVertexCellIndex(int vertexIndex, int cellIndex[3]);
+	void getVertexOffset(int vertexIndex, float offset[3]);
+
+	// Index of the first vertex in a cell with z-index k or greater (the number of 
+	// vertices if there is none). Requires vertices in ScanOrder.
+	int firstVertexInSlice(int k);
+
 private:
 	// Use of C-style arrays. C-style arrays are used deliberately for cell indices, 
 	// vertex positions, cells in the cell map, vertices, etc. This was done after
@@ -43,42 +80,141 @@ private:
 	int m_arraySize[3];
 	float m_voxelSize[3];
 
-	struct Cell {
-		unsigned short label;
-		MMCellFlag flag;
-		int vertexIndex;
-		float vertexOffset[3];
+	// The cell grid holds only what is needed for topology. It is one cell larger than
+	// the label array on each face so that volume faces are padded with a reserved 
+	// label. Each cell has the label of its left-back-bottom corner and the index of its
+	// vertex (-1 if the cell has no vertex). Labels are not padded; they are read
+	// from the caller's array, from a copy of it (m_labelCopy) or from palette-compressed
+	// bricks (m_labelBricks), and labels outside the array are read as the padding 
+	// label. m_padRow is a row of padding labels. Label arrays are addressed in bytes and
+	// read according to the label type.
+	int m_labelArraySize[3];
+	LabelType m_labelType;
+	int m_labelBytes;
+	unsigned int m_padLabel;
+	const unsigned char *m_labels;
+	unsigned char *m_labelCopy;
+	MMLabelBricks *m_labelBricks;
+	unsigned char *m_padRow;
+
+	// Rows of compressed labels are decoded into a per-thread buffer with 4 rows. Row 
+	// (j, k) is decoded to slot (j & 1) + 2 * (k & 1), so rows shared by successive rows
+	// of cells are decoded once.
+	struct LabelRows {
+		std::vector<unsigned char> buffer;
+		size_t rowIndices[4];
 	};
-	Cell *m_cellArray;
+	void initLabelRows(LabelRows &labelRows);
+
+	// Cell vertex indices are stored in bricks of 8 x 8 x 8 cells. Only bricks that 
+	// contain vertices are allocated, so memory scales with the surface area rather than
+	// the volume. m_brickIndices holds, for each brick of the cell grid, the index of 
+	// its cells in m_brickVertexIndices, or -1 if the brick has no vertices. Cells in
+	// a brick are ordered x fastest, then y, then z.
+	enum { BrickShift = 3, BrickSize = 1 << BrickShift, BrickCells = BrickSize * BrickSize * BrickSize };
+	int m_brickArraySize[3];
+	int *m_brickIndices;
+	int m_numBricks;
+	int *m_brickVertexIndices;
+
+	// Vertex data is stored densely by vertex index, typically for only a small 
+	// fraction of cells. Only cells with vertices can have edge or face crossings,
+	// so cell flags are stored per vertex. Vertex offsets are stored as [x0, y0, z0, 
+	// x1, y1, ...] relative to the left-back-bottom corner of the vertex cell in 
+	// voxel units.
+	//
+	// Cell array indices are 64-bit. Vertex indices are 32-bit, which halves the size 
+	// of the brick vertex index arrays and of the neighbor arrays and keeps the 
+	// relaxation kernels' 32-bit gathers. The number of vertices is limited so that
+	// per-vertex offsets (3 per vertex) and neighbor offsets (at most 6 per vertex) fit
+	// in an int; if a surface has more vertices, the cell map is left empty.
+	//
+	// Vertices are numbered in cell scan order or, with VertexOrder::BrickOrder, by brick
+	// and in Morton order within each brick (see sortSlabVertices()).
+	//
+	// MM_MAX_NUM_VERTICES can be defined to lower the limit, e.g., to test it with
+	// small volumes.
+#ifndef MM_MAX_NUM_VERTICES
+#define MM_MAX_NUM_VERTICES (INT_MAX / 6)
+#endif
+	static const int maxNumVertices = MM_MAX_NUM_VERTICES;
 	struct Vertex {
 		int cellIndex[3];
 	};
 	int m_numVertices;
 	Vertex *m_vertices;
-	void initCell(Cell* cell, unsigned short label);
+	MMCellFlag *m_vertexFlags;
+	float *m_vertexOffsets;
+	VertexOrder m_vertexOrder;
 	void setCellVertices();
+	void sortSlabVertices(std::vector<Vertex> &vertices, std::vector<MMCellFlag> &flags);
+	void freeMemory();
+
+	// Vertex neighbors used for relaxation, stored in compressed sparse row form. The
+	// neighbors of vertex v are m_nbrIndices[m_nbrBegin[v]] to m_nbrIndices[m_nbrBegin[v 
+	// + 1] - 1]. For each vertex, m_nbrCellDeltaSums stores the sum over its neighbors 
+	// of (neighbor cell index - vertex cell index), which converts neighbor offsets to
+	// the vertex's cell coordinates.
+	int *m_nbrBegin;
+	int *m_nbrIndices;
+	float *m_nbrCellDeltaSums;
+	void setVertexNeighbors();
+
+	// Statistics of each label other than the padding label, in increasing order of 
+	// label. Computed during construction from runs of labels in each label row and 
+	// from the labels of each quad.
+	std::vector<MMSurfaceNet::LabelStats> m_labelStats;
+	void setLabelStats();
+
+	// Index of each label in m_labelStats, or -1, addressed directly by label. The 
+	// table covers labels up to the largest label and is only made when it is not much
+	// larger than the number of labels (e.g., for any 8- or 16-bit labels); otherwise 
+	// labels are found by bisection.
+	std::vector<int> m_labelIndexTable;
+	void setLabelIndexTable();
+	const unsigned char *getLabelRow(int j, int k, unsigned char *rowBuffer);
+
+	// Relaxation
+	MMSurfaceNet::RelaxStats relaxSequential(MMSurfaceNet::RelaxAttrs relaxAttrs);
+	MMSurfaceNet::RelaxStats relaxJacobi(MMSurfaceNet::RelaxAttrs relaxAttrs);
+
+	// Active set of vertices used to skip vertices that are not moving during relaxation.
+	// Vertices are listed in vertex order. Vertex v depends on vertex u if u is one of 
+	// its neighbors; dependents are stored in compressed sparse row form. The vertex 
+	// lists are swapped after each update and both have one more entry than the number
+	// of vertices, because updateActiveSet() writes each vertex before checking it.
+	struct ActiveSet {
+		int numVertices;
+		int *vertices;
+		int *nextVertices;			// Work array for building the next active set
+		unsigned char *hasMoved;	// Per listed vertex, set if it moved more than epsilon
+		unsigned char *isActive;	// Per vertex work array
+		float *movedOffsets;		// Per vertex offset where it was last marked as moved
+		int *dependentBegin;
+		int *dependentIndices;
+	};
+	bool initActiveSet(ActiveSet &activeSet);
+	void freeActiveSet(ActiveSet &activeSet);
+	void markMovedVertex(ActiveSet &activeSet, int idx, const float *p, float epsilon);
+	int updateActiveSet(ActiveSet &activeSet);
+
+	void relaxVertex(int vertexIndex, MMSurfaceNet::RelaxAttrs relaxAttrs, 
+		const float *srcOffsets, float *dstOffsets);
 
 	// Access cell map
-	Cell *getCell(int cellIndex[3]);
-	Cell *getCell(int i, int j, int k);
-	Cell *getCell(int cellArrayIndex);
-	int cellArrayIndex(int cellIndex[3]);
-	int cellArrayIndex(int i, int j, int k);
-	void getCellLabels(Cell *cell, unsigned short labels[8]);
-	bool isEdgeCrossing(int cellArrayIndex, MMCellFlag::Edge edge);
-	MMCellFlag::VertexType cellVertexType(int cellArrayIndex);
-	void getEdgeLabels(int cellIndex[3], MMCellFlag::Edge edge, unsigned short quadLabels[2]);
+	size_t brickCellArrayIndex(int i, int j, int k);
+	int cellVertexIndex(int i, int j, int k);
+	unsigned int label(int i, int j, int k);
+	void getCellRows(int j, int k, LabelRows &labelRows, const unsigned char *rows[4]);
+	int findRowBoundaryCells(MMRelaxKernel::InstructionSet instructionSet, const unsigned char *rows[4],
+		int *rowCells);
+	void getCellLabels(const unsigned char *rows[4], int i, unsigned int labels[8]);
+	void getEdgeLabels(int cellIndex[3], MMCellFlag::Edge edge, unsigned int quadLabels[2]);
 	void getEdgeQuadPositions(int cellIndex[3], MMCellFlag::Edge edge, float quadCorners[12]);
 	void getEdgeQuadVtxIndices(int cellIndex[3], MMCellFlag::Edge edge, int quadVtxIndices[4]);
 
-	// Access vertex data
-	void getVertexCellIndex(int vertexIndex, int cellIndex[3]);
-	void getVertexPosition(int cellIndex[3], float position[3]);
-	void getVertexPosition(int i, int j, int k, float position[3]);
-	int vertexFaceNeighborVertexIndex(int vertexIndex, MMCellFlag::Face face);
-
 	// Access cell neighbors
-	Cell *getFaceNeighborCellAndIndex(int cellIndex[3], MMCellFlag::Face face, int nbrCellIndex[3]);
+	void getFaceNeighborCellIndex(int cellIndex[3], MMCellFlag::Face face, int nbrCellIndex[3]);
 };
 
 #endif
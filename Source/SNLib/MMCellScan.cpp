@@ -0,0 +1,162 @@
+// MMCellScan.cpp
+//
+// MMCellScan implementation
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include "MMCellScan.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MM_CELL_SCAN_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MM_TARGET_AVX2
+static inline unsigned int lowestSetBit(unsigned int mask)
+{
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned int)index;
+}
+#else
+#define MM_TARGET_AVX2 __attribute__((target("avx2")))
+static inline unsigned int lowestSetBit(unsigned int mask)
+{
+	return (unsigned int)__builtin_ctz(mask);
+}
+#endif
+#endif
+
+//
+// Scalar implementation. A cell is homogeneous if its left and right columns of 4 
+// corner labels each match the cell's first corner label.
+//
+template <typename Label>
+static int findCellsScalar(const Label *rows[4], int begin, int numCells,
+	int *cellIndices, int numFound)
+{
+	for (int i = begin; i < numCells; i++) {
+		Label label = rows[0][i];
+		if (label != rows[0][i + 1] ||
+			label != rows[1][i] || label != rows[1][i + 1] ||
+			label != rows[2][i] || label != rows[2][i + 1] ||
+			label != rows[3][i] || label != rows[3][i + 1]) {
+			cellIndices[numFound++] = i;
+		}
+	}
+	return numFound;
+}
+
+#ifdef MM_CELL_SCAN_X86
+
+// Append the cells for the lanes of a byte mask that are not set. Each label lane 
+// contributes sizeof(Label) bits to the mask.
+template <typename Label>
+static inline int appendCells(unsigned int isHomogeneousMask, unsigned int laneBits, 
+	int firstCell, int *cellIndices, int numFound)
+{
+	const unsigned int laneMask = (1u << sizeof(Label)) - 1;
+	unsigned int mask = ~isHomogeneousMask & laneBits;
+	while (mask) {
+		unsigned int bit = lowestSetBit(mask);
+		cellIndices[numFound++] = firstCell + (int)(bit / sizeof(Label));
+		mask &= ~(laneMask << bit);
+	}
+	return numFound;
+}
+
+// Lane-wise label comparisons for each label size
+template <typename Label> static inline __m128i isEqual128(__m128i a, __m128i b);
+template <> inline __m128i isEqual128<unsigned char>(__m128i a, __m128i b) { return _mm_cmpeq_epi8(a, b); }
+template <> inline __m128i isEqual128<unsigned short>(__m128i a, __m128i b) { return _mm_cmpeq_epi16(a, b); }
+template <> inline __m128i isEqual128<unsigned int>(__m128i a, __m128i b) { return _mm_cmpeq_epi32(a, b); }
+
+template <typename Label> MM_TARGET_AVX2 static inline __m256i isEqual256(__m256i a, __m256i b);
+template <> MM_TARGET_AVX2 inline __m256i isEqual256<unsigned char>(__m256i a, __m256i b) { return _mm256_cmpeq_epi8(a, b); }
+template <> MM_TARGET_AVX2 inline __m256i isEqual256<unsigned short>(__m256i a, __m256i b) { return _mm256_cmpeq_epi16(a, b); }
+template <> MM_TARGET_AVX2 inline __m256i isEqual256<unsigned int>(__m256i a, __m256i b) { return _mm256_cmpeq_epi32(a, b); }
+
+//
+// SSE2 implementation. Compares 16 bytes of labels (e.g., 8 cells with 16-bit labels)
+// at a time.
+//
+template <typename Label>
+static int findCellsSSE2(const Label *rows[4], int numCells, int *cellIndices)
+{
+	const int numLanes = 16 / sizeof(Label);
+	int numFound = 0;
+	int i = 0;
+	for (; i + numLanes <= numCells; i += numLanes) {
+		__m128i label = _mm_loadu_si128((const __m128i *)&rows[0][i]);
+		__m128i isEqual = isEqual128<Label>(label, _mm_loadu_si128((const __m128i *)&rows[0][i + 1]));
+		for (int r = 1; r < 4; r++) {
+			__m128i left = _mm_loadu_si128((const __m128i *)&rows[r][i]);
+			__m128i right = _mm_loadu_si128((const __m128i *)&rows[r][i + 1]);
+			isEqual = _mm_and_si128(isEqual, _mm_and_si128(isEqual128<Label>(label, left), 
+				isEqual128<Label>(label, right)));
+		}
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(isEqual);
+		if (mask != 0xFFFF) numFound = appendCells<Label>(mask, 0xFFFF, i, cellIndices, numFound);
+	}
+	return findCellsScalar(rows, i, numCells, cellIndices, numFound);
+}
+
+//
+// AVX2 implementation. Compares 32 bytes of labels (e.g., 16 cells with 16-bit labels)
+// at a time.
+//
+template <typename Label>
+MM_TARGET_AVX2
+static int findCellsAVX2(const Label *rows[4], int numCells, int *cellIndices)
+{
+	const int numLanes = 32 / sizeof(Label);
+	int numFound = 0;
+	int i = 0;
+	for (; i + numLanes <= numCells; i += numLanes) {
+		__m256i label = _mm256_loadu_si256((const __m256i *)&rows[0][i]);
+		__m256i isEqual = isEqual256<Label>(label, _mm256_loadu_si256((const __m256i *)&rows[0][i + 1]));
+		for (int r = 1; r < 4; r++) {
+			__m256i left = _mm256_loadu_si256((const __m256i *)&rows[r][i]);
+			__m256i right = _mm256_loadu_si256((const __m256i *)&rows[r][i + 1]);
+			isEqual = _mm256_and_si256(isEqual, _mm256_and_si256(isEqual256<Label>(label, left), 
+				isEqual256<Label>(label, right)));
+		}
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(isEqual);
+		if (mask != 0xFFFFFFFF) numFound = appendCells<Label>(mask, 0xFFFFFFFF, i, cellIndices, numFound);
+	}
+	return findCellsScalar(rows, i, numCells, cellIndices, numFound);
+}
+
+#endif
+
+template <typename Label>
+static int findCells(MMRelaxKernel::InstructionSet instructionSet, const Label *rows[4], 
+	int numCells, int *cellIndices)
+{
+	switch (instructionSet) {
+#ifdef MM_CELL_SCAN_X86
+	case MMRelaxKernel::InstructionSet::AVX2:
+		return findCellsAVX2(rows, numCells, cellIndices);
+	case MMRelaxKernel::InstructionSet::SSE2:
+		return findCellsSSE2(rows, numCells, cellIndices);
+#endif
+	default:
+		return findCellsScalar(rows, 0, numCells, cellIndices, 0);
+	}
+}
+
+int MMCellScan::findNonHomogeneousCells(MMRelaxKernel::InstructionSet instructionSet,
+	const unsigned char *rows[4], int numCells, int *cellIndices)
+{
+	return findCells(instructionSet, rows, numCells, cellIndices);
+}
+int MMCellScan::findNonHomogeneousCells(MMRelaxKernel::InstructionSet instructionSet,
+	const unsigned short *rows[4], int numCells, int *cellIndices)
+{
+	return findCells(instructionSet, rows, numCells, cellIndices);
+}
+int MMCellScan::findNonHomogeneousCells(MMRelaxKernel::InstructionSet instructionSet,
+	const unsigned int *rows[4], int numCells, int *cellIndices)
+{
+	return findCells(instructionSet, rows, numCells, cellIndices);
+}
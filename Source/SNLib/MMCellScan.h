@@ -0,0 +1,32 @@
+// MMCellScan.h
+//
+// Interface for MMCellScan, which finds cells whose corner labels are not all equal.
+// Most cells lie inside homogeneous regions, so rows of cells are scanned with SIMD 
+// comparisons of adjacent label rows and only the remaining cells need cell flags.
+// The instruction set is chosen at run time as for MMRelaxKernel.
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#ifndef MM_CELL_SCAN_H
+#define MM_CELL_SCAN_H
+
+#include "MMRelaxKernel.h"
+
+class MMCellScan
+{
+public:
+	// Find the cells in a row of numCells cells whose 8 corner labels are not all 
+	// equal. rows[0] to rows[3] point to the labels of the rows at the cell corners 
+	// (j, k), (j + 1, k), (j, k + 1) and (j + 1, k + 1), each with numCells + 1 labels.
+	// The indices of the cells within the row are written to cellIndices in increasing
+	// order and their number is returned. Versions are provided for 8, 16 and 32-bit 
+	// labels.
+	static int findNonHomogeneousCells(MMRelaxKernel::InstructionSet instructionSet,
+		const unsigned char *rows[4], int numCells, int *cellIndices);
+	static int findNonHomogeneousCells(MMRelaxKernel::InstructionSet instructionSet,
+		const unsigned short *rows[4], int numCells, int *cellIndices);
+	static int findNonHomogeneousCells(MMRelaxKernel::InstructionSet instructionSet,
+		const unsigned int *rows[4], int numCells, int *cellIndices);
+};
+
+#endif
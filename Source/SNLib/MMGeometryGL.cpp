@@ -5,23 +5,27 @@
 // Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
 
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <vector>
 
 #include "MMSurfaceNet.h"
 #include "MMGeometryGL.h"
 #include "MMCellMap.h"
 #include "MMCellFlag.h"
 
-MMGeometryGL::MMGeometryGL(MMSurfaceNet* surfaceNet) :
+MMGeometryGL::MMGeometryGL(MMSurfaceNet* surfaceNet, Shading shading) :
 	m_origin{ 0, 0, 0 },
 	m_size{ 0, 0, 0 },
 	m_numVertices(0),
 	m_numIndices(0),
 	m_vertices(nullptr),
-	m_indices(nullptr)
+	m_indices(nullptr),
+	m_isValid(false)
 {
 	if (surfaceNet == nullptr) return;
 	MMCellMap* cellMap = surfaceNet->m_cellMap;
-	if (!cellMap) return;
+	if (!cellMap || !cellMap->isValid()) return;
 
 	int arraySize[3];
 	float voxelSize[3];
@@ -32,15 +36,24 @@ MMGeometryGL::MMGeometryGL(MMSurfaceNet* surfaceNet) :
 		m_size[i] = arraySize[i] * voxelSize[i];
 	}
 
-	// Allocate memory
+	// Construct geometry
+	if (shading == Shading::Smooth) makeSmoothGeometry(cellMap);
+	else makeFlatGeometry(cellMap);
+}
+
+void MMGeometryGL::makeFlatGeometry(MMCellMap* cellMap)
+{
+	// Allocate memory. Sizes are computed in 64 bits. Vertex indices are 32-bit GL 
+	// indices, so geometry is not made if there are too many quad vertices to index.
 	try {
-		int numQuads = cellMap->numEdgeCrossings();
-		int numVertsPerQuad = 4;
-		int numFloatsPerVertex = sizeof(GLVertex) / sizeof(float); 
-		long int numFloats = numQuads * numVertsPerQuad * numFloatsPerVertex;
+		size_t numQuads = cellMap->numEdgeCrossings();
+		size_t numVertsPerQuad = 4;
+		size_t numFloatsPerVertex = sizeof(GLVertex) / sizeof(float); 
+		if (numQuads * numVertsPerQuad > UINT_MAX) return;
+		size_t numFloats = numQuads * numVertsPerQuad * numFloatsPerVertex;
 		m_vertices = new float[numFloats];
-		int numIndicesPerQuad = 6;
-		long int numIndices = numQuads * numIndicesPerQuad;
+		size_t numIndicesPerQuad = 6;
+		size_t numIndices = numQuads * numIndicesPerQuad;
 		m_indices = new unsigned int[numIndices];
 	}
 	catch (std::bad_alloc& ba)
@@ -52,12 +65,6 @@ MMGeometryGL::MMGeometryGL(MMSurfaceNet* surfaceNet) :
 		return;
 	}
 
-	// Make a mapping from each label to a texture coordinate for GL rendering
-	std::vector<int> labels = surfaceNet->labels();
-	for (int i = 0; i < labels.size(); i++) {
-		m_labelToTexCoord.insert(std::make_pair(labels[i], float(i)));
-	}
-
 	// Construct geometry
 	m_numVertices = 0;
 	m_numIndices = 0;
@@ -65,12 +72,13 @@ MMGeometryGL::MMGeometryGL(MMSurfaceNet* surfaceNet) :
 	unsigned int* pIndices = m_indices;
 	for (int idxVtx = 0; idxVtx < cellMap->numVertices(); idxVtx++) {
 		float vertexPositions[12];
-		unsigned short labels[2];
+		unsigned int labels[2];
 
 		// Back-bottom edge
 		if (cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::BackBottomEdge,
 			vertexPositions, labels) == true) {
-			MMGeometryGL::makeGLQuad(vertexPositions, labels, pVertices, pIndices, m_numVertices);
+			float texCoords[2] = { labelTexCoord(cellMap, labels[0]), labelTexCoord(cellMap, labels[1]) };
+			MMGeometryGL::makeGLQuad(vertexPositions, texCoords, pVertices, pIndices, (unsigned int)m_numVertices);
 			pVertices += 4 * 8;
 			pIndices += 6;
 			m_numVertices += 4;
@@ -80,7 +88,8 @@ MMGeometryGL::MMGeometryGL(MMSurfaceNet* surfaceNet) :
 		// Left-bottom edge
 		if (cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::LeftBottomEdge,
 			vertexPositions, labels) == true) {
-			MMGeometryGL::makeGLQuad(vertexPositions, labels, pVertices, pIndices, m_numVertices);
+			float texCoords[2] = { labelTexCoord(cellMap, labels[0]), labelTexCoord(cellMap, labels[1]) };
+			MMGeometryGL::makeGLQuad(vertexPositions, texCoords, pVertices, pIndices, (unsigned int)m_numVertices);
 			pVertices += 4 * 8;
 			pIndices += 6;
 			m_numVertices += 4;
@@ -90,13 +99,153 @@ MMGeometryGL::MMGeometryGL(MMSurfaceNet* surfaceNet) :
 		// Left-back edge
 		if (cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::LeftBackEdge,
 			vertexPositions, labels) == true) {
-			MMGeometryGL::makeGLQuad(vertexPositions, labels, pVertices, pIndices, m_numVertices);
+			float texCoords[2] = { labelTexCoord(cellMap, labels[0]), labelTexCoord(cellMap, labels[1]) };
+			MMGeometryGL::makeGLQuad(vertexPositions, texCoords, pVertices, pIndices, (unsigned int)m_numVertices);
 			pVertices += 4 * 8;
 			pIndices += 6;
 			m_numVertices += 4;
 			m_numIndices += 6;
 		}
 	}
+	m_isValid = true;
+}
+
+void MMGeometryGL::makeSmoothGeometry(MMCellMap* cellMap)
+{
+	// Allocate indices and make GL vertices. GL vertices are counted as they are made, so
+	// GL vertex data is allocated once all quads have been visited. There are at most 4
+	// GL vertices per quad, so GL vertex indices fit in 32 bits under the same limit as
+	// flat shading. The GL vertex lists grow as quads are visited, so visiting quads is
+	// guarded against allocation failure along with the initial allocation.
+	size_t numQuads = cellMap->numEdgeCrossings();
+	if (numQuads * 4 > UINT_MAX) return;
+	std::vector<int> glVertexNetIndices;
+	std::vector<unsigned int> glVertexLabels;
+	std::vector<unsigned int> nextGLVertex;
+	std::vector<unsigned int> firstGLVertex;
+	const unsigned int noGLVertex = UINT_MAX;
+	const MMCellFlag::Edge edges[3] = { MMCellFlag::Edge::BackBottomEdge,
+		MMCellFlag::Edge::LeftBottomEdge, MMCellFlag::Edge::LeftBackEdge };
+	m_numIndices = 0;
+	try {
+		m_indices = new unsigned int[numQuads * 6];
+		glVertexNetIndices.reserve(cellMap->numVertices());
+		glVertexLabels.reserve(2 * (size_t)cellMap->numVertices());
+		nextGLVertex.reserve(cellMap->numVertices());
+
+		// GL vertices are shared by quads with the same SurfaceNet vertex and the same 
+		// pair of labels. The GL vertices of a SurfaceNet vertex are kept in a list 
+		// starting at firstGLVertex, and are usually few. 
+		firstGLVertex.assign(cellMap->numVertices(), noGLVertex);
+		for (int idxVtx = 0; idxVtx < cellMap->numVertices(); idxVtx++) {
+			for (int idxEdge = 0; idxEdge < 3; idxEdge++) {
+				int quadVtxIndices[4];
+				unsigned int labels[2];
+				if (!cellMap->getEdgeQuad(idxVtx, edges[idxEdge], quadVtxIndices, labels)) continue;
+
+				// Orient the quad so that the smaller label is on its front face
+				if (labels[0] > labels[1]) {
+					std::swap(labels[0], labels[1]);
+					std::swap(quadVtxIndices[1], quadVtxIndices[3]);
+				}
+				unsigned int quadGLVertices[4];
+				for (int i = 0; i < 4; i++) {
+					unsigned int glVertex = firstGLVertex[quadVtxIndices[i]];
+					while (glVertex != noGLVertex && (glVertexLabels[2 * glVertex] != labels[0] ||
+						glVertexLabels[2 * glVertex + 1] != labels[1])) {
+						glVertex = nextGLVertex[glVertex];
+					}
+					if (glVertex == noGLVertex) {
+						glVertex = (unsigned int)glVertexNetIndices.size();
+						glVertexNetIndices.push_back(quadVtxIndices[i]);
+						glVertexLabels.push_back(labels[0]);
+						glVertexLabels.push_back(labels[1]);
+						nextGLVertex.push_back(firstGLVertex[quadVtxIndices[i]]);
+						firstGLVertex[quadVtxIndices[i]] = glVertex;
+					}
+					quadGLVertices[i] = glVertex;
+				}
+				unsigned int* quadIndices = &m_indices[m_numIndices];
+				quadIndices[0] = quadGLVertices[0];
+				quadIndices[1] = quadGLVertices[1];
+				quadIndices[2] = quadGLVertices[2];
+				quadIndices[3] = quadGLVertices[0];
+				quadIndices[4] = quadGLVertices[2];
+				quadIndices[5] = quadGLVertices[3];
+				m_numIndices += 6;
+			}
+		}
+	}
+	catch (std::bad_alloc& ba)
+	{
+		delete[] m_indices;
+		m_indices = nullptr;
+		m_numIndices = 0;
+		return;
+	}
+
+	// Allocate and set GL vertex positions and texture coordinates
+	size_t numGLVertices = glVertexNetIndices.size();
+	try {
+		m_vertices = new float[numGLVertices * 8];
+	}
+	catch (std::bad_alloc& ba)
+	{
+		delete[] m_indices;
+		m_indices = nullptr;
+		m_numIndices = 0;
+		return;
+	}
+	m_numVertices = numGLVertices;
+	for (size_t glVertex = 0; glVertex < numGLVertices; glVertex++) {
+		float* pVert = &m_vertices[8 * glVertex];
+		cellMap->getVertexPosition(glVertexNetIndices[glVertex], pVert);
+		pVert[3] = 0.0f;
+		pVert[4] = 0.0f;
+		pVert[5] = 0.0f;
+		pVert[6] = labelTexCoord(cellMap, glVertexLabels[2 * glVertex]);
+		pVert[7] = labelTexCoord(cellMap, glVertexLabels[2 * glVertex + 1]);
+	}
+
+	// Accumulate area-weighted quad normals at quad vertices. The cross product of the 
+	// quad diagonals has the direction of the quad normal and twice the quad area.
+	for (size_t idxIndex = 0; idxIndex < m_numIndices; idxIndex += 6) {
+		const unsigned int* quadIndices = &m_indices[idxIndex];
+		unsigned int quadGLVertices[4] = { quadIndices[0], quadIndices[1], quadIndices[2], quadIndices[5] };
+		float* p0 = &m_vertices[8 * quadGLVertices[0]];
+		float* p1 = &m_vertices[8 * quadGLVertices[1]];
+		float* p2 = &m_vertices[8 * quadGLVertices[2]];
+		float* p3 = &m_vertices[8 * quadGLVertices[3]];
+		float v1[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		float v2[3] = { p3[0] - p1[0], p3[1] - p1[1], p3[2] - p1[2] };
+		float crossProduct[3] = {
+			v1[1] * v2[2] - v1[2] * v2[1],
+			v1[2] * v2[0] - v1[0] * v2[2],
+			v1[0] * v2[1] - v1[1] * v2[0] };
+		for (int i = 0; i < 4; i++) {
+			float* norm = &m_vertices[8 * quadGLVertices[i] + 3];
+			norm[0] += crossProduct[0];
+			norm[1] += crossProduct[1];
+			norm[2] += crossProduct[2];
+		}
+	}
+
+	// Normalize vertex normals
+	for (size_t glVertex = 0; glVertex < numGLVertices; glVertex++) {
+		float* norm = &m_vertices[8 * glVertex + 3];
+		float len = sqrtf(norm[0] * norm[0] + norm[1] * norm[1] + norm[2] * norm[2]);
+		if (len > 0.000001) {
+			norm[0] /= len;
+			norm[1] /= len;
+			norm[2] /= len;
+		}
+		else {
+			norm[0] = 0.0f;
+			norm[1] = 0.0f;
+			norm[2] = 0.0f;
+		}
+	}
+	m_isValid = true;
 }
 
 MMGeometryGL::~MMGeometryGL()
@@ -118,8 +267,14 @@ void MMGeometryGL::maxSize(float size[3])
 	size[2] = m_size[2];
 }
 
-void MMGeometryGL::makeGLQuad(float *positions, unsigned short tissueLabels[2],
-	float *quadVerts, unsigned int *quadIndices, int idxOffset)
+float MMGeometryGL::labelTexCoord(MMCellMap* cellMap, unsigned int label)
+{
+	int idxLabel = cellMap->labelIndex(label);
+	return (idxLabel >= 0) ? float(idxLabel) : 0.0f;
+}
+
+void MMGeometryGL::makeGLQuad(float *positions, float texCoords[2],
+	float *quadVerts, unsigned int *quadIndices, unsigned int idxOffset)
 {
 	float norm[3];
 	computeQuadNormal(positions, norm);
@@ -132,8 +287,8 @@ void MMGeometryGL::makeGLQuad(float *positions, unsigned short tissueLabels[2],
 		*pVert++ = norm[0];
 		*pVert++ = norm[1];
 		*pVert++ = norm[2];
-		*pVert++ = m_labelToTexCoord[tissueLabels[0]];
-		*pVert++ = m_labelToTexCoord[tissueLabels[1]];
+		*pVert++ = texCoords[0];
+		*pVert++ = texCoords[1];
 	}
 	quadIndices[0] = idxOffset + 0;
 	quadIndices[1] = idxOffset + 1;
@@ -1,17 +1,19 @@
 // MMGeometryGL.h
 //
 // Interface for MMGeometryGL, which converts a SurfaceNet into a form that can be used
-// for rendering by OpenGL (e.g., as C-style triangle vertex and index arrays). In this 
-// implementation, surface quads are flat shaded (i.e., one surface normal per quad).
+// for rendering by OpenGL (e.g., as C-style triangle vertex and index arrays). Surface 
+// quads are either flat shaded (i.e., one surface normal per quad) or smooth shaded 
+// with vertices shared between quads.
 //
 // Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
 
 #ifndef MM_GEOMETRY_GL_H
 #define MM_GEOMETRY_GL_H
 
-#include <map>
+#include <cstddef>
 
 class MMSurfaceNet;
+class MMCellMap;
 
 class MMGeometryGL
 {
@@ -22,31 +24,49 @@ public:
 		float tex[2];
 	};
 
-	MMGeometryGL(MMSurfaceNet* surfaceNet);
+	// Flat shading makes 4 GL vertices per quad with the quad's normal. Smooth shading
+	// makes one GL vertex per SurfaceNet vertex for each pair of labels that meet at
+	// the vertex, shared by all quads between those labels, with a normal that is the
+	// area-weighted average of the normals of those quads. Quads between the same 
+	// labels are oriented consistently, with the smaller label on their front face.
+	enum class Shading { Flat, Smooth };
+	MMGeometryGL(MMSurfaceNet* surfaceNet, Shading shading = Shading::Flat);
 	~MMGeometryGL();
 
+	// False if the geometry could not be made because the SurfaceNet is not valid, 
+	// memory could not be allocated or there are too many quad vertices for 32-bit GL
+	// indices, in which case the geometry is empty
+	bool isValid() { return m_isValid; };
+
 	void origin(float origin[3]);
 	void maxSize(float size[3]);
 
 	// Vertices are returned as a sequential list of C-style float[8] arrays (i.e., 
 	// {pos[0], pos[1], pos[2], norm[0], norm[1], norm[2], tex[0], tex[1]}). Indices 
 	// are returned as a sequential list of C-style int[3] arrays (i.e., {v0, v1, v2}).
-	int numVertices() { return m_numVertices; };
+	size_t numVertices() { return m_numVertices; };
 	float* vertices() { return (float *)m_vertices; };
-	int numIndices() { return m_numIndices; };
+	size_t numIndices() { return m_numIndices; };
 	unsigned int* indices() { return m_indices; };
 
 private:
 	float m_origin[3];
 	float m_size[3];
-	int m_numVertices;
-	int m_numIndices;
+	size_t m_numVertices;
+	size_t m_numIndices;
 	float *m_vertices;
 	unsigned int *m_indices;
-	std::map<int, float> m_labelToTexCoord;
+	bool m_isValid;
+
+	// Texture coordinates are compact label indices (see MMSurfaceNet::labelIndex()), 
+	// which index the renderer's color map. Labels that are not in the SurfaceNet 
+	// (i.e., the padding label) have texture coordinate 0.
+	static float labelTexCoord(MMCellMap* cellMap, unsigned int label);
 
-	void makeGLQuad(float* positions, unsigned short tissueLabels[2], float* quadVerts,
-		unsigned int* quadIndices, int idxOffset);
+	void makeFlatGeometry(MMCellMap* cellMap);
+	void makeSmoothGeometry(MMCellMap* cellMap);
+	void makeGLQuad(float* positions, float texCoords[2], float* quadVerts,
+		unsigned int* quadIndices, unsigned int idxOffset);
 	void computeQuadNormal(float* positions, float* normal);
 };
 
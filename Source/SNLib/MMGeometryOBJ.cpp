@@ -5,150 +5,144 @@
 // Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
 
 #include <array>
+#include <atomic>
+#include <cmath>
+#include <new>
 #include <vector>
-#include <map>
+#include <algorithm>
+#include <climits>
 
 #include "MMGeometryOBJ.h"
 #include "MMCellMap.h"
+#include "MMParallel.h"
+#include "MMQuadList.h"
 
-//
-// Private data class for storing quad data during OBJ data generation
-//
-class MMQuad {
-public:
-	MMQuad() :
-		m_vertexIndices{ -1, -1, -1, -1 },
-		m_labels{ 0, 0 }
-	{
-	}
-	MMQuad(int vi[4], unsigned short labels[2]) :
-		m_vertexIndices{ vi[0], vi[1], vi[2], vi[3] },
-		m_labels{ labels[0], labels[1]}
-	{
-	}
-
-	void getVertexIndices(int vertexIndices[4])
-	{
-		for (int i = 0; i < 4; i++) vertexIndices[i] = m_vertexIndices[i];
-	}
-	void getLabels(unsigned short labels[2])
-	{
-		for (int i = 0; i < 2; i++) labels[i] = m_labels[i];
-	}
-	void setVertexIndices(int vertexIndices[4])
-	{
-		for (int i = 0; i < 4; i++) m_vertexIndices[i] = vertexIndices[i];
-	}
-	void setLabels(unsigned short labels[2])
-	{
-		for (int i = 0; i < 2; i++) m_labels[i] = labels[i];
-	}
-
-private:
-	int m_vertexIndices[4];
-	unsigned short m_labels[2];
-}; 
+// Label quad entries, (quadIndex << 1) | side, fit in an int if there are at most 
+// INT_MAX / 2 quads, i.e., at most INT_MAX / 6 vertices with 3 quads each
+static_assert(MM_MAX_NUM_VERTICES <= INT_MAX / 6, "Label quad entries must fit in an int");
 
 //
 // MMGeometryOBJ implementation
 //
 MMGeometryOBJ::MMGeometryOBJ(MMSurfaceNet *surfaceNet) :
-	m_surfaceNet(surfaceNet)
+	m_surfaceNet(surfaceNet),
+	m_quadList(nullptr)
 {
 	if (m_surfaceNet == nullptr) return;
 	MMCellMap *cellMap = surfaceNet->m_cellMap;
 	if (cellMap == nullptr) return;
 
-	// Create temporary storage for cell quads which are constructed around edges 
-	// crossed by the surface. Handle 3 edges per cell. The other 9 cell edges will 
-	// be handled when neighboring cells that share edges with this cell are visited.
-	for (int idxVtx = 0; idxVtx < cellMap->numVertices(); idxVtx++) {
-		int vertexIndices[4];
-		unsigned short quadLabels[2];
-
-		// Back-bottom edge
-		if (cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::BackBottomEdge, vertexIndices, quadLabels) == true) {
-			MMQuad quad(vertexIndices, quadLabels);
-			m_quads.push_back(quad);
-		}
-
-		// Left-bottom edge
-		if (cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::LeftBottomEdge, vertexIndices, quadLabels) == true) {
-			MMQuad quad(vertexIndices, quadLabels);
-			m_quads.push_back(quad);
-		}
+	// Cell quads are constructed around edges crossed by the surface. The quad list 
+	// handles 3 edges per cell. The other 9 cell edges will be handled when neighboring 
+	// cells that share edges with this cell are visited.
+	m_quadList = new MMQuadList(cellMap);
+	if (!m_quadList->isValid()) {
+		delete m_quadList;
+		m_quadList = nullptr;
+		return;
+	}
 
-		// Left-back edge
-		if (cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::LeftBackEdge, vertexIndices, quadLabels) == true) {
-			MMQuad quad(vertexIndices, quadLabels);
-			m_quads.push_back(quad);
+	// Allocate the label quad index. The number of quads of each label is known from 
+	// the label statistics of the SurfaceNet, so quads are placed directly in their rows.
+	const std::vector<MMSurfaceNet::LabelStats> &labelStats = surfaceNet->labelStats();
+	m_labelQuadBegin.assign(labelStats.size() + 1, 0);
+	for (size_t idxLabel = 0; idxLabel < labelStats.size(); idxLabel++) {
+		m_labelQuadBegin[idxLabel + 1] = m_labelQuadBegin[idxLabel] + labelStats[idxLabel].numQuads;
+	}
+	m_labelQuads.resize(m_labelQuadBegin.back());
+	std::vector<size_t> labelQuadEnd(m_labelQuadBegin.begin(), m_labelQuadBegin.end() - 1);
+
+	// Index the quads of each label, except the padding label
+	unsigned int paddingLabel = surfaceNet->paddingLabel();
+	for (size_t idxQuad = 0; idxQuad < m_quadList->size(); idxQuad++) {
+		unsigned int quadLabels[2];
+		m_quadList->getLabels(idxQuad, quadLabels);
+		for (int side = 0; side < 2; side++) {
+			if (quadLabels[side] == paddingLabel) continue;
+			if (side == 1 && quadLabels[1] == quadLabels[0]) continue;
+			int idxLabel = surfaceNet->labelIndex(quadLabels[side]);
+			m_labelQuads[labelQuadEnd[idxLabel]++] = ((int)idxQuad << 1) | side;
 		}
 	}
 }
 MMGeometryOBJ::~MMGeometryOBJ()
 {
+	delete m_quadList;
 }
 
-std::vector<int> MMGeometryOBJ::labels()
+std::vector<unsigned int> MMGeometryOBJ::labels()
 {
 	return m_surfaceNet->labels();
 }
-MMGeometryOBJ::OBJData MMGeometryOBJ::objData(int label)
+MMGeometryOBJ::OBJData MMGeometryOBJ::objData(unsigned int label)
 {
 	OBJData output;
-
-	// Initialize a dictionary of vertex data for quads that touch this material
-	std::map<int, vtxData> vtxDataMap;	// key: vertexIndex, value: vtxData for this vertex
-	for (std::vector<MMQuad>::iterator itQuad = m_quads.begin(); itQuad != m_quads.end(); itQuad++) {
-		unsigned short quadLabels[2];
-		itQuad->getLabels(quadLabels);
-		if (label == quadLabels[0] || label == quadLabels[1]) {
-			int quadVtxIndices[4];
-			itQuad->getVertexIndices(quadVtxIndices);
-			for (int i = 0; i < 4; i++) {
-				vtxData vDataInit = { -1, 0, 0, 0 };
-				vtxDataMap.insert(std::make_pair(quadVtxIndices[i], vDataInit));
-			}
-		}
+	int idxLabel = (m_quadList != nullptr) ? m_surfaceNet->labelIndex(label) : -1;
+	if (idxLabel < 0) return(output);
+	const int *labelQuads = m_labelQuads.data() + m_labelQuadBegin[idxLabel];
+	size_t numLabelQuads = m_labelQuadBegin[idxLabel + 1] - m_labelQuadBegin[idxLabel];
+
+	// Find the unique vertices of quads that touch this material in increasing order 
+	// of vertex index. Quad corners are derived once and kept for triangulation.
+	std::vector<int> quadVtxIndices(4 * numLabelQuads);
+	for (size_t i = 0; i < numLabelQuads; i++) {
+		m_quadList->getVertexIndices(labelQuads[i] >> 1, &quadVtxIndices[4 * i]);
 	}
+	std::vector<int> vertexIndices(quadVtxIndices);
+	std::sort(vertexIndices.begin(), vertexIndices.end());
+	vertexIndices.erase(std::unique(vertexIndices.begin(), vertexIndices.end()), vertexIndices.end());
 
-	// Update the dictionary of unique vertices with OBJ vertex index and position. Store 
-	// vertex position in the output. OBJ vertex indexing starts at 1 (OBJ convention) 
-	// rather than 0 (C++ convention)
-	int vID = 1;
+	// Store vertex positions in the output. The OBJ vertex index of a vertex is its 
+	// position in vertexIndices plus 1 because OBJ vertex indexing starts at 1 (OBJ 
+	// convention) rather than 0 (C++ convention)
 	MMCellMap* cellMap = m_surfaceNet->m_cellMap;
-	for (std::map<int, vtxData>::iterator itVtxData = vtxDataMap.begin(); itVtxData != vtxDataMap.end(); itVtxData++) {
-		float position[3];
-		int cellIdx = itVtxData->first;
-		cellMap->getVertexPosition(cellIdx, position);
-		itVtxData->second = { vID++, position[0], position[1], position[2]};
-		std::array<float, 3> p({ position[0], position[1], position[2] });
-		output.vertexPositions.push_back(p);
+	output.vertexPositions.resize(vertexIndices.size());
+	for (size_t i = 0; i < vertexIndices.size(); i++) {
+		cellMap->getVertexPosition(vertexIndices[i], output.vertexPositions[i].data());
 	}
 
-	// Get face vertex indices (two triangles per quad) and store them in the output.
-	for (std::vector<MMQuad>::iterator itQuad = m_quads.begin(); itQuad != m_quads.end(); itQuad++) {
-		int quadVtxIndices[4];
-		unsigned short quadLabels[2];
-		itQuad->getLabels(quadLabels);
-		itQuad->getVertexIndices(quadVtxIndices);
-		if (label == quadLabels[0] || label == quadLabels[1]) {
-			vtxData vData[4];
-			for (int i = 0; i < 4; i++) {
-				vData[i] = vtxDataMap[quadVtxIndices[i]];
-			}
-			bool isQuadFrontFacing = (label == quadLabels[0]) ? true : false;
-			int triangleVtxIDs[6];
-			MMGeometryOBJ::getQuadTriangleIDs(vData, isQuadFrontFacing, triangleVtxIDs);
-			std::array<int, 3> t1({ triangleVtxIDs[0], triangleVtxIDs[1], triangleVtxIDs[2] });
-			std::array<int, 3> t2({ triangleVtxIDs[3], triangleVtxIDs[4], triangleVtxIDs[5] });
-			output.triangles.push_back(t1);
-			output.triangles.push_back(t2);
+	// Get face vertex indices (two triangles per quad) and store them in the output. 
+	// Quads are front facing for the label on their top face.
+	output.triangles.reserve(2 * numLabelQuads);
+	for (size_t i = 0; i < numLabelQuads; i++) {
+		vtxData vData[4];
+		for (int j = 0; j < 4; j++) {
+			int vID = (int)(std::lower_bound(vertexIndices.begin(), vertexIndices.end(), 
+				quadVtxIndices[4 * i + j]) - vertexIndices.begin());
+			const std::array<float, 3> &p = output.vertexPositions[vID];
+			vData[j] = { vID + 1, p[0], p[1], p[2] };
 		}
+		bool isQuadFrontFacing = ((labelQuads[i] & 1) == 0) ? true : false;
+		int triangleVtxIDs[6];
+		MMGeometryOBJ::getQuadTriangleIDs(vData, isQuadFrontFacing, triangleVtxIDs);
+		std::array<int, 3> t1({ triangleVtxIDs[0], triangleVtxIDs[1], triangleVtxIDs[2] });
+		std::array<int, 3> t2({ triangleVtxIDs[3], triangleVtxIDs[4], triangleVtxIDs[5] });
+		output.triangles.push_back(t1);
+		output.triangles.push_back(t2);
 	}
 
 	return(output);
 }
+std::vector<MMGeometryOBJ::OBJData> MMGeometryOBJ::objData(const std::vector<unsigned int> &labels, 
+	int numThreads)
+{
+	// Labels are independent, so each thread extracts a contiguous range of labels. An
+	// exception thrown on a worker thread would terminate the program, so allocation 
+	// failures are caught by each thread and rethrown on the calling thread.
+	std::vector<OBJData> output(labels.size());
+	std::atomic<bool> isOutOfMemory(false);
+	MMParallel::forRange(0, (int)labels.size(), MMParallel::numThreads(numThreads), 
+		[&](int beginLabel, int endLabel) {
+		try {
+			for (int i = beginLabel; i < endLabel; i++) output[i] = objData(labels[i]);
+		}
+		catch (std::bad_alloc& ba) {
+			isOutOfMemory = true;
+		}
+	});
+	if (isOutOfMemory) throw std::bad_alloc();
+	return(output);
+}
 
 void crossProduct(float v0[3], float v1[3], float result[3])
 {
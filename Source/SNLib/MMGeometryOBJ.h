@@ -11,7 +11,7 @@
 #include <set>
 
 class MMSurfaceNet;
-class MMQuad;
+class MMQuadList;
 
 class MMGeometryOBJ
 {
@@ -19,6 +19,10 @@ public:
 	MMGeometryOBJ(MMSurfaceNet *surfaceNet);
 	~MMGeometryOBJ();
 
+	// The quad list is owned by the geometry, so geometry cannot be copied
+	MMGeometryOBJ(const MMGeometryOBJ &) = delete;
+	MMGeometryOBJ &operator=(const MMGeometryOBJ &) = delete;
+
 	// OBJ data for a single model consists of a vector of unique vertex positions
 	// (x, y, z) and a vector of triangle faces (v0, v1, v2), where v0, v1 and v2 are 
 	// indices into the vertex position vector. Note that indices in OBJData start at
@@ -29,13 +33,30 @@ public:
 	};
 
 	// Get the material labels for this SurfaceNet and the OBJ data for surfaces of the  
-	// specified label
-	std::vector<int> labels();
-	OBJData objData(int label);
+	// specified label. Only the quads of the specified label are visited.
+	std::vector<unsigned int> labels();
+	OBJData objData(unsigned int label);
+
+	// Get the OBJ data for each of the specified labels, with labels extracted in 
+	// parallel on numThreads threads (one per core if numThreads <= 0). Element i of 
+	// the result holds the OBJ data of labels[i]. Like objData(label), throws 
+	// std::bad_alloc if memory cannot be allocated.
+	std::vector<OBJData> objData(const std::vector<unsigned int> &labels, int numThreads = 0);
 
 private:
 	MMSurfaceNet* m_surfaceNet;
-	std::vector<MMQuad> m_quads;
+	MMQuadList* m_quadList;
+
+	// Index of the quads of each label in compressed sparse row form, with labels 
+	// indexed by MMSurfaceNet::labelIndex(). The quads of label i are m_labelQuads[j] 
+	// for m_labelQuadBegin[i] <= j < m_labelQuadBegin[i + 1], in increasing order of 
+	// quad. Each quad is indexed under both of its labels, except the padding label, as
+	// (quadIndex << 1) | side, where side is 0 for the label on the quad's top face and
+	// 1 for the label on its bottom face. Entries fit in an int because there are at most
+	// 3 quads per vertex and the cell map limits the number of vertices to INT_MAX / 6
+	// (checked in MMGeometryOBJ.cpp).
+	std::vector<size_t> m_labelQuadBegin;
+	std::vector<int> m_labelQuads;
 
 	struct vtxData {
 		int vID;
@@ -0,0 +1,269 @@
+// MMLabelBricks.cpp
+//
+// MMLabelBricks implementation
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <exception>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "MMLabelBricks.h"
+#include "MMParallel.h"
+
+// Bits per voxel index for a palette of paletteSize labels
+static int indexBitsForPalette(int paletteSize)
+{
+	if (paletteSize <= 1) return 0;
+	if (paletteSize <= 2) return 1;
+	if (paletteSize <= 4) return 2;
+	if (paletteSize <= 16) return 4;
+	if (paletteSize <= 256) return 8;
+	return 16;
+}
+
+// Sorted distinct labels of a brick. Most bricks lie inside a single material, so
+// bricks with a single label are detected before sorting.
+static int makePalette(const unsigned int *brickLabels, int numLabels, unsigned int *palette)
+{
+	const unsigned int *pEnd = brickLabels + numLabels;
+	if (std::find_if(brickLabels, pEnd, [&](unsigned int label) {
+		return label != brickLabels[0]; }) == pEnd) {
+		palette[0] = brickLabels[0];
+		return 1;
+	}
+	std::copy(brickLabels, pEnd, palette);
+	std::sort(palette, palette + numLabels);
+	return (int)(std::unique(palette, palette + numLabels) - palette);
+}
+
+// Compressed labels
+MMLabelBricks::MMLabelBricks(const void *labels, LabelType labelType, int arraySize[3]) :
+	m_labelType(labelType),
+	m_numBricks(0),
+	m_bricks(NULL),
+	m_paletteSize(0),
+	m_palette(NULL),
+	m_indicesSize(0),
+	m_indices(NULL)
+{
+	for (int i = 0; i < 3; i++) {
+		m_arraySize[i] = arraySize[i];
+		m_brickArraySize[i] = (arraySize[i] + BrickSize - 1) >> BrickShift;
+	}
+	switch (labelType) {
+	case LabelType::UInt8:
+		compress((const unsigned char *)labels);
+		break;
+	case LabelType::UInt32:
+		compress((const unsigned int *)labels);
+		break;
+	default:
+		compress((const unsigned short *)labels);
+		break;
+	}
+}
+MMLabelBricks::~MMLabelBricks()
+{
+	freeMemory();
+}
+bool MMLabelBricks::isValid()
+{
+	return (m_bricks != NULL);
+}
+// Bytes allocated for bricks, palettes and voxel indices
+size_t MMLabelBricks::memorySize()
+{
+	if (m_bricks == NULL) return 0;
+	return m_numBricks * sizeof(Brick) + m_paletteSize * sizeof(unsigned int) + m_indicesSize;
+}
+
+// Label of voxel (i, j, k)
+unsigned int MMLabelBricks::label(int i, int j, int k)
+{
+	const Brick &brick = m_bricks[(i >> BrickShift) + m_brickArraySize[0] *
+		((j >> BrickShift) + (size_t)m_brickArraySize[1] * (k >> BrickShift))];
+	const unsigned int *palette = &m_palette[brick.paletteOffset];
+	int voxel = (i & (BrickSize - 1)) + BrickSize * ((j & (BrickSize - 1)) + BrickSize * (k & (BrickSize - 1)));
+	switch (brick.indexBits) {
+	case 0:
+		return palette[0];
+	case 16:
+		return palette[((const unsigned short *)&m_indices[brick.indexOffset])[voxel]];
+	default:
+		{
+			int bit = voxel * brick.indexBits;
+			unsigned int mask = (1u << brick.indexBits) - 1;
+			return palette[(m_indices[brick.indexOffset + (bit >> 3)] >> (bit & 7)) & mask];
+		}
+	}
+}
+
+// Decode the row of labels (j, k)
+void MMLabelBricks::decodeRow(int j, int k, unsigned char *row)
+{
+	switch (m_labelType) {
+	case LabelType::UInt8:
+		decodeRow<unsigned char>(j, k, row);
+		break;
+	case LabelType::UInt32:
+		decodeRow(j, k, (unsigned int *)row);
+		break;
+	default:
+		decodeRow(j, k, (unsigned short *)row);
+		break;
+	}
+}
+template <typename Label>
+void MMLabelBricks::decodeRow(int j, int k, Label *row)
+{
+	// Rows of 8 voxel indices occupy indexBits bytes
+	int brickRow = (j & (BrickSize - 1)) + BrickSize * (k & (BrickSize - 1));
+	const Brick *pBrick = &m_bricks[m_brickArraySize[0] *
+		((j >> BrickShift) + (size_t)m_brickArraySize[1] * (k >> BrickShift))];
+	for (int bi = 0; bi < m_brickArraySize[0]; bi++, pBrick++) {
+		const unsigned int *palette = &m_palette[pBrick->paletteOffset];
+		Label *pRow = &row[bi << BrickShift];
+		int rowLength = std::min((int)BrickSize, m_arraySize[0] - (bi << BrickShift));
+		int indexBits = pBrick->indexBits;
+		if (indexBits == 0) {
+			std::fill(pRow, pRow + rowLength, (Label)palette[0]);
+		}
+		else if (indexBits == 16) {
+			const unsigned short *indices = (const unsigned short *)&m_indices[pBrick->indexOffset] +
+				brickRow * BrickSize;
+			for (int i = 0; i < rowLength; i++) pRow[i] = (Label)palette[indices[i]];
+		}
+		else {
+			const unsigned char *indices = &m_indices[pBrick->indexOffset + brickRow * indexBits];
+			unsigned int mask = (1u << indexBits) - 1;
+			for (int i = 0; i < rowLength; i++) {
+				int bit = i * indexBits;
+				pRow[i] = (Label)palette[(indices[bit >> 3] >> (bit & 7)) & mask];
+			}
+		}
+	}
+}
+
+// Labels of brick (bi, bj, bk) ordered x fastest. Voxels outside the label array
+// repeat the last voxel of the array so that they do not add labels to the palette.
+template <typename Label>
+void MMLabelBricks::getBrickLabels(const Label *labels, int bi, int bj, int bk,
+	unsigned int brickLabels[BrickVoxels])
+{
+	unsigned int *pLabel = brickLabels;
+	for (int k = 0; k < BrickSize; k++) {
+		int labelK = std::min((bk << BrickShift) + k, m_arraySize[2] - 1);
+		for (int j = 0; j < BrickSize; j++) {
+			int labelJ = std::min((bj << BrickShift) + j, m_arraySize[1] - 1);
+			const Label *row = &labels[m_arraySize[0] * (labelJ + (size_t)m_arraySize[1] * labelK)];
+			for (int i = 0; i < BrickSize; i++) {
+				int labelI = std::min((bi << BrickShift) + i, m_arraySize[0] - 1);
+				*pLabel++ = row[labelI];
+			}
+		}
+	}
+}
+
+// Compress labels in two passes over parallel z-slabs of bricks. The first pass finds
+// the palette size of each brick, which determines where its palette and indices are
+// stored; the second pass stores them. All memory is allocated before each pass, so 
+// the threads do not allocate and cannot throw.
+template <typename Label>
+void MMLabelBricks::compress(const Label *labels)
+{
+	m_numBricks = m_brickArraySize[0] * m_brickArraySize[1] * m_brickArraySize[2];
+	std::vector<int> paletteSizes;
+	try {
+		m_bricks = new Brick[m_numBricks];
+		paletteSizes.resize(m_numBricks);
+	}
+	catch (std::bad_alloc& ba) {
+		freeMemory();
+		return;
+	}
+	int slabSize = m_brickArraySize[0] * m_brickArraySize[1];
+	int numThreads = MMParallel::numThreads(0);
+	MMParallel::forRange(0, m_brickArraySize[2], numThreads, [&](int beginK, int endK) {
+		unsigned int brickLabels[BrickVoxels];
+		unsigned int palette[BrickVoxels];
+		for (int bk = beginK; bk < endK; bk++) {
+			int idxBrick = bk * slabSize;
+			for (int bj = 0; bj < m_brickArraySize[1]; bj++) {
+				for (int bi = 0; bi < m_brickArraySize[0]; bi++, idxBrick++) {
+					getBrickLabels(labels, bi, bj, bk, brickLabels);
+					paletteSizes[idxBrick] = makePalette(brickLabels, BrickVoxels, palette);
+				}
+			}
+		}
+	});
+
+	// Pack palettes and indices in brick order
+	m_paletteSize = 0;
+	m_indicesSize = 0;
+	for (int idxBrick = 0; idxBrick < m_numBricks; idxBrick++) {
+		Brick &brick = m_bricks[idxBrick];
+		brick.paletteOffset = m_paletteSize;
+		brick.indexOffset = m_indicesSize;
+		brick.indexBits = indexBitsForPalette(paletteSizes[idxBrick]);
+		m_paletteSize += paletteSizes[idxBrick];
+		m_indicesSize += BrickVoxels / 8 * brick.indexBits;
+	}
+	try {
+		m_palette = new unsigned int[m_paletteSize];
+		m_indices = new unsigned char[m_indicesSize];
+	}
+	catch (std::bad_alloc& ba) {
+		freeMemory();
+		return;
+	}
+	MMParallel::forRange(0, m_brickArraySize[2], numThreads, [&](int beginK, int endK) {
+		unsigned int brickLabels[BrickVoxels];
+		unsigned int palette[BrickVoxels];
+		for (int bk = beginK; bk < endK; bk++) {
+			int idxBrick = bk * slabSize;
+			for (int bj = 0; bj < m_brickArraySize[1]; bj++) {
+				for (int bi = 0; bi < m_brickArraySize[0]; bi++, idxBrick++) {
+					const Brick &brick = m_bricks[idxBrick];
+					getBrickLabels(labels, bi, bj, bk, brickLabels);
+					int paletteSize = makePalette(brickLabels, BrickVoxels, palette);
+					std::copy(palette, palette + paletteSize, &m_palette[brick.paletteOffset]);
+					if (brick.indexBits == 0) continue;
+
+					// Voxel indices are found by binary search of the sorted palette
+					unsigned char *indices = &m_indices[brick.indexOffset];
+					if (brick.indexBits == 16) {
+						unsigned short *indices16 = (unsigned short *)indices;
+						for (int v = 0; v < BrickVoxels; v++) {
+							indices16[v] = (unsigned short)(std::lower_bound(palette, palette +
+								paletteSize, brickLabels[v]) - palette);
+						}
+						continue;
+					}
+					memset(indices, 0, BrickVoxels / 8 * brick.indexBits);
+					for (int v = 0; v < BrickVoxels; v++) {
+						unsigned int index = (unsigned int)(std::lower_bound(palette, palette +
+							paletteSize, brickLabels[v]) - palette);
+						int bit = v * brick.indexBits;
+						indices[bit >> 3] |= (unsigned char)(index << (bit & 7));
+					}
+				}
+			}
+		}
+	});
+}
+
+void MMLabelBricks::freeMemory()
+{
+	if (m_bricks) delete[] m_bricks;
+	if (m_palette) delete[] m_palette;
+	if (m_indices) delete[] m_indices;
+	m_numBricks = 0;
+	m_bricks = NULL;
+	m_paletteSize = 0;
+	m_palette = NULL;
+	m_indicesSize = 0;
+	m_indices = NULL;
+}
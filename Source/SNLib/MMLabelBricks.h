@@ -0,0 +1,64 @@
+// MMLabelBricks.h
+//
+// Interface for MMLabelBricks, which store labels compressed in bricks of 8 x 8 x 8
+// voxels. Segmentations typically have only a few labels in any neighborhood, so each
+// brick stores its distinct labels once in a palette and each voxel stores the index
+// of its label in the palette with 0, 1, 2, 4, 8 or 16 bits.
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#ifndef MM_LABEL_BRICKS_H
+#define MM_LABEL_BRICKS_H
+
+#include <cstddef>
+
+#include "MMSurfaceNet.h"
+
+class MMLabelBricks
+{
+public:
+	// Compress a 3D array of labels of type labelType. If memory cannot be allocated,
+	// the bricks are left empty and isValid() returns false.
+	typedef MMSurfaceNet::LabelType LabelType;
+	MMLabelBricks(const void *labels, LabelType labelType, int arraySize[3]);
+	~MMLabelBricks();
+	bool isValid();
+	size_t memorySize();
+
+	// Label of voxel (i, j, k). The caller is responsible for bounds checking.
+	unsigned int label(int i, int j, int k);
+
+	// Decode the row of labels (j, k) into row, which holds arraySize[0] labels of the
+	// original label type
+	void decodeRow(int j, int k, unsigned char *row);
+
+private:
+	enum { BrickShift = 3, BrickSize = 1 << BrickShift, BrickVoxels = BrickSize * BrickSize * BrickSize };
+	int m_arraySize[3];
+	int m_brickArraySize[3];
+	LabelType m_labelType;
+
+	// Bricks are ordered x fastest, then y, then z. The palette of a brick starts at
+	// m_palette[paletteOffset] and its voxel indices start at m_indices[indexOffset],
+	// with voxels ordered x fastest and indexBits bits per voxel, so that each row of
+	// a brick occupies indexBits bytes. Bricks with a single label have no indices.
+	struct Brick {
+		size_t paletteOffset;
+		size_t indexOffset;
+		int indexBits;
+	};
+	int m_numBricks;
+	Brick *m_bricks;
+	size_t m_paletteSize;
+	unsigned int *m_palette;
+	size_t m_indicesSize;
+	unsigned char *m_indices;
+	void freeMemory();
+
+	template <typename Label> void compress(const Label *labels);
+	template <typename Label> void getBrickLabels(const Label *labels, int bi, int bj, int bk,
+		unsigned int brickLabels[BrickVoxels]);
+	template <typename Label> void decodeRow(int j, int k, Label *row);
+};
+
+#endif
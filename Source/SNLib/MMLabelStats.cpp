@@ -0,0 +1,79 @@
+// MMLabelStats.cpp
+//
+// MMLabelStats implementation
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <algorithm>
+#include <climits>
+
+#include "MMLabelStats.h"
+
+MMLabelStats::MMLabelStats(unsigned int ignoredLabel) :
+	m_ignoredLabel(ignoredLabel),
+	m_lastLabel(ignoredLabel),
+	m_lastIndex(-1)
+{
+}
+
+// Statistics of a label, added with no voxels or quads if the label is new
+MMLabelStats::LabelStats &MMLabelStats::labelStats(unsigned int label)
+{
+	if (label == m_lastLabel && m_lastIndex >= 0) return m_stats[m_lastIndex];
+	std::unordered_map<unsigned int, int>::iterator itLabel = m_labelIndices.find(label);
+	if (itLabel == m_labelIndices.end()) {
+		LabelStats stats = { label, 0, 0, { INT_MAX, INT_MAX, INT_MAX }, { -1, -1, -1 } };
+		itLabel = m_labelIndices.insert(std::make_pair(label, (int)m_stats.size())).first;
+		m_stats.push_back(stats);
+	}
+	m_lastLabel = label;
+	m_lastIndex = itLabel->second;
+	return m_stats[m_lastIndex];
+}
+
+// Add a run of voxels in a row
+void MMLabelStats::addVoxels(unsigned int label, int beginI, int endI, int j, int k)
+{
+	if (label == m_ignoredLabel || endI <= beginI) return;
+	LabelStats &stats = labelStats(label);
+	stats.numVoxels += endI - beginI;
+	stats.minVoxel[0] = std::min(stats.minVoxel[0], beginI);
+	stats.minVoxel[1] = std::min(stats.minVoxel[1], j);
+	stats.minVoxel[2] = std::min(stats.minVoxel[2], k);
+	stats.maxVoxel[0] = std::max(stats.maxVoxel[0], endI - 1);
+	stats.maxVoxel[1] = std::max(stats.maxVoxel[1], j);
+	stats.maxVoxel[2] = std::max(stats.maxVoxel[2], k);
+}
+
+// Add a quad to the labels on both of its sides
+void MMLabelStats::addQuad(const unsigned int quadLabels[2])
+{
+	if (quadLabels[0] != m_ignoredLabel) labelStats(quadLabels[0]).numQuads++;
+	if (quadLabels[1] != m_ignoredLabel && quadLabels[1] != quadLabels[0]) {
+		labelStats(quadLabels[1]).numQuads++;
+	}
+}
+
+// Add the statistics of other to this
+void MMLabelStats::merge(const MMLabelStats &other)
+{
+	for (std::vector<LabelStats>::const_iterator itOther = other.m_stats.begin();
+		itOther != other.m_stats.end(); itOther++) {
+		LabelStats &stats = labelStats(itOther->label);
+		stats.numQuads += itOther->numQuads;
+		stats.numVoxels += itOther->numVoxels;
+		for (int i = 0; i < 3; i++) {
+			stats.minVoxel[i] = std::min(stats.minVoxel[i], itOther->minVoxel[i]);
+			stats.maxVoxel[i] = std::max(stats.maxVoxel[i], itOther->maxVoxel[i]);
+		}
+	}
+}
+
+// Statistics in increasing order of label
+std::vector<MMLabelStats::LabelStats> MMLabelStats::sortedStats()
+{
+	std::vector<LabelStats> sortedStats(m_stats);
+	std::sort(sortedStats.begin(), sortedStats.end(),
+		[](const LabelStats &a, const LabelStats &b) { return a.label < b.label; });
+	return sortedStats;
+}
@@ -0,0 +1,50 @@
+// MMLabelStats.h
+//
+// Interface for MMLabelStats, which accumulates the number of voxels, bounding box and
+// number of surface quads of each label while a cell map is constructed
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#ifndef MM_LABEL_STATS_H
+#define MM_LABEL_STATS_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "MMSurfaceNet.h"
+
+class MMLabelStats
+{
+public:
+	// Statistics are accumulated for every label except the ignored (padding) label.
+	// Statistics of parts of a volume can be accumulated separately (e.g., by separate
+	// threads) and merged.
+	typedef MMSurfaceNet::LabelStats LabelStats;
+	MMLabelStats(unsigned int ignoredLabel);
+
+	// Add a run of voxels [beginI, endI) in row (j, k) with the same label
+	void addVoxels(unsigned int label, int beginI, int endI, int j, int k);
+
+	// Add a quad between two labels
+	void addQuad(const unsigned int quadLabels[2]);
+
+	// Add the statistics of other to this
+	void merge(const MMLabelStats &other);
+
+	// Statistics of all labels in increasing order of label
+	std::vector<LabelStats> sortedStats();
+
+private:
+	unsigned int m_ignoredLabel;
+
+	// Labels are mapped to their statistics by a hash map. Labels usually repeat along
+	// rows and surfaces, so the last label found is cached.
+	std::unordered_map<unsigned int, int> m_labelIndices;
+	std::vector<LabelStats> m_stats;
+	unsigned int m_lastLabel;
+	int m_lastIndex;
+	LabelStats &labelStats(unsigned int label);
+};
+
+#endif
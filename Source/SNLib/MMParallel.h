@@ -0,0 +1,147 @@
+// MMParallel.h
+//
+// Minimal helpers for splitting SNLib loops across threads
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#ifndef MM_PARALLEL_H
+#define MM_PARALLEL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class MMParallel
+{
+public:
+	// Number of threads to use for a requested thread count. A requested count of 
+	// zero or less selects one thread per available core.
+	static int numThreads(int requestedNumThreads)
+	{
+		if (requestedNumThreads > 0) return requestedNumThreads;
+		int numCores = (int)std::thread::hardware_concurrency();
+		return (numCores > 0) ? numCores : 1;
+	}
+
+	// Split the range [begin, end) into at most numThreads contiguous sub-ranges and
+	// call func(subBegin, subEnd) for each sub-range on its own thread. The calling
+	// thread processes the first sub-range. Sub-ranges depend only on the range and 
+	// the thread count.
+	template <typename Func>
+	static void forRange(int begin, int end, int numThreads, Func func)
+	{
+		int numItems = end - begin;
+		if (numItems <= 0) return;
+		if (numThreads > numItems) numThreads = numItems;
+		if (numThreads <= 1) {
+			func(begin, end);
+			return;
+		}
+		std::vector<std::thread> threads;
+		threads.reserve(numThreads - 1);
+		for (int idxThread = 1; idxThread < numThreads; idxThread++) {
+			int subBegin = begin + (int)((long long)numItems * idxThread / numThreads);
+			int subEnd = begin + (int)((long long)numItems * (idxThread + 1) / numThreads);
+			threads.push_back(std::thread(func, subBegin, subEnd));
+		}
+		func(begin, begin + (int)((long long)numItems / numThreads));
+		for (std::thread& thread : threads) thread.join();
+	}
+
+	// Threads that are started once and reused for many forRange() calls, for loops 
+	// such as relaxation iterations that are too short to pay for starting threads on
+	// every call. Ranges are split as by MMParallel::forRange(), so results do not 
+	// depend on whether a pool is used. The calling thread processes the first 
+	// sub-range and numThreads - 1 worker threads process the others.
+	class ThreadPool
+	{
+	public:
+		ThreadPool(int numThreads) :
+			m_numThreads(numThreads > 1 ? numThreads : 1),
+			m_generation(0),
+			m_numPending(0),
+			m_isStopping(false)
+		{
+			m_workers.reserve(m_numThreads - 1);
+			for (int idxThread = 1; idxThread < m_numThreads; idxThread++) {
+				m_workers.push_back(std::thread(&ThreadPool::work, this, idxThread));
+			}
+		}
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_isStopping = true;
+			}
+			m_startCondition.notify_all();
+			for (std::thread& worker : m_workers) worker.join();
+		}
+		int numThreads() { return m_numThreads; }
+
+		template <typename Func>
+		void forRange(int begin, int end, Func func)
+		{
+			int numItems = end - begin;
+			if (numItems <= 0) return;
+			int numThreads = (m_numThreads > numItems) ? numItems : m_numThreads;
+			if (numThreads <= 1) {
+				func(begin, end);
+				return;
+			}
+
+			// Idle workers (idxThread >= numThreads) have no sub-range
+			std::function<void(int)> task = [&](int idxThread) {
+				if (idxThread >= numThreads) return;
+				int subBegin = begin + (int)((long long)numItems * idxThread / numThreads);
+				int subEnd = begin + (int)((long long)numItems * (idxThread + 1) / numThreads);
+				func(subBegin, subEnd);
+			};
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_task = &task;
+				m_numPending = m_numThreads - 1;
+				m_generation++;
+			}
+			m_startCondition.notify_all();
+			task(0);
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_doneCondition.wait(lock, [this] { return m_numPending == 0; });
+			m_task = nullptr;
+		}
+
+	private:
+		int m_numThreads;
+		std::vector<std::thread> m_workers;
+		std::mutex m_mutex;
+		std::condition_variable m_startCondition;
+		std::condition_variable m_doneCondition;
+		std::function<void(int)> *m_task;
+		unsigned long long m_generation;
+		int m_numPending;
+		bool m_isStopping;
+
+		void work(int idxThread)
+		{
+			unsigned long long generation = 0;
+			for (;;) {
+				std::function<void(int)> *task;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_startCondition.wait(lock, [&] { return m_isStopping || m_generation != generation; });
+					if (m_isStopping) return;
+					generation = m_generation;
+					task = m_task;
+				}
+				(*task)(idxThread);
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if (--m_numPending == 0) m_doneCondition.notify_one();
+				}
+			}
+		}
+	};
+};
+
+#endif
@@ -0,0 +1,75 @@
+// MMQuadList.cpp
+//
+// MMQuadList implementation
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <new>
+
+#include "MMQuadList.h"
+#include "MMCellMap.h"
+
+const MMCellFlag::Edge MMQuadList::axisEdges[3] = { MMCellFlag::Edge::BackBottomEdge,
+	MMCellFlag::Edge::LeftBottomEdge, MMCellFlag::Edge::LeftBackEdge };
+
+MMQuadList::MMQuadList(MMCellMap *cellMap) :
+	m_cellMap(cellMap),
+	m_numQuads(0),
+	m_quads(NULL)
+{
+	// Allocate the exact number of quads, which is the number of crossings of the 3 
+	// edges per vertex cell that define quads
+	size_t numQuads = cellMap->numEdgeCrossings();
+	try {
+		m_quads = new unsigned int[numQuads];
+	}
+	catch (std::bad_alloc& ba) {
+		m_quads = NULL;
+		return;
+	}
+	m_numQuads = numQuads;
+
+	// Pack quads in vertex order
+	size_t idxQuad = 0;
+	for (int idxVtx = 0; idxVtx < cellMap->numVertices(); idxVtx++) {
+		for (unsigned int axis = 0; axis < 3; axis++) {
+			if (cellMap->isEdgeCrossing(idxVtx, axisEdges[axis])) {
+				m_quads[idxQuad++] = ((unsigned int)idxVtx << AxisBits) | axis;
+			}
+		}
+	}
+}
+MMQuadList::~MMQuadList()
+{
+	delete[] m_quads;
+}
+bool MMQuadList::isValid()
+{
+	return m_quads != NULL;
+}
+size_t MMQuadList::size()
+{
+	return m_numQuads;
+}
+size_t MMQuadList::memorySize()
+{
+	return m_numQuads * sizeof(unsigned int);
+}
+
+// Quads are unpacked on demand
+int MMQuadList::vertexIndex(size_t quadIndex)
+{
+	return (int)(m_quads[quadIndex] >> AxisBits);
+}
+MMCellFlag::Edge MMQuadList::edge(size_t quadIndex)
+{
+	return axisEdges[m_quads[quadIndex] & AxisMask];
+}
+void MMQuadList::getVertexIndices(size_t quadIndex, int quadVtxIndices[4])
+{
+	m_cellMap->getQuadVtxIndices(vertexIndex(quadIndex), edge(quadIndex), quadVtxIndices);
+}
+void MMQuadList::getLabels(size_t quadIndex, unsigned int quadLabels[2])
+{
+	m_cellMap->getQuadLabels(vertexIndex(quadIndex), edge(quadIndex), quadLabels);
+}
@@ -0,0 +1,54 @@
+// MMQuadList.h
+//
+// Interface for MMQuadList, a compact list of the surface quads of a cell map. Each 
+// quad is stored as the index of the vertex whose cell holds the quad's edge and the 
+// edge's axis, packed into one 32-bit integer. Quad corners and labels are derived 
+// from the cell map on demand.
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#ifndef MM_QUAD_LIST_H
+#define MM_QUAD_LIST_H
+
+#include <cstddef>
+
+#include "MMCellFlag.h"
+
+class MMCellMap;
+
+class MMQuadList
+{
+public:
+	// Quads of the cell map in increasing order of vertex index and, for each vertex,
+	// around its back-bottom, left-bottom and left-back edges. The list is allocated 
+	// with the exact number of quads. If memory cannot be allocated, the list is empty
+	// and isValid() returns false. The cell map must outlive the quad list.
+	MMQuadList(MMCellMap *cellMap);
+	~MMQuadList();
+	MMQuadList(const MMQuadList &) = delete;
+	MMQuadList &operator=(const MMQuadList &) = delete;
+	bool isValid();
+	size_t size();
+	size_t memorySize();
+
+	// Vertex indices of the quad's corners in clockwise order and labels of the quad as
+	// [labelTopFaceOfQuad, labelBottomFaceOfQuad], as given by MMCellMap::getEdgeQuad()
+	void getVertexIndices(size_t quadIndex, int quadVtxIndices[4]);
+	void getLabels(size_t quadIndex, unsigned int quadLabels[2]);
+
+	// Vertex index and edge of a quad
+	int vertexIndex(size_t quadIndex);
+	MMCellFlag::Edge edge(size_t quadIndex);
+
+private:
+	// A quad is stored as (vertexIndex << 2) | axis, with axis 0, 1 and 2 for the 
+	// back-bottom (x), left-bottom (y) and left-back (z) edges. The cell map limits 
+	// vertex indices to less than 2^30.
+	enum { AxisBits = 2, AxisMask = (1 << AxisBits) - 1 };
+	static const MMCellFlag::Edge axisEdges[3];
+	MMCellMap *m_cellMap;
+	size_t m_numQuads;
+	unsigned int *m_quads;
+};
+
+#endif
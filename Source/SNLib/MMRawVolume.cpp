@@ -0,0 +1,237 @@
+// MMRawVolume.cpp
+//
+// MMRawVolume implementation
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <chrono>
+#include <new>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+
+#include "MMRawVolume.h"
+#include "MMCellMap.h"
+
+MMRawVolume::MMRawVolume(const char *fileName, LabelType labelType, int arraySize[3],
+	size_t headerSize) :
+	m_labelType(labelType),
+	m_labels(nullptr),
+	m_labelCopy(nullptr),
+	m_mapping(nullptr),
+	m_mappingSize(0),
+#if defined(_WIN32)
+	m_file(INVALID_HANDLE_VALUE),
+	m_fileMapping(nullptr)
+#else
+	m_file(-1)
+#endif
+{
+	for (int i = 0; i < 3; i++) m_arraySize[i] = arraySize[i];
+	for (int i = 0; i < 3; i++) m_phaseStats[i] = PhaseStats{ 0.0, 0, 0 };
+	size_t labelBytes = (size_t)arraySize[0] * arraySize[1] * arraySize[2] *
+		MMCellMap::labelSize(labelType);
+	PhaseTimer timer;
+	startPhase(timer);
+
+	// Map the whole file, advising the system that it will be read sequentially
+#if defined(_WIN32)
+	m_file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	LARGE_INTEGER fileSize;
+	if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &fileSize) ||
+		(unsigned long long)fileSize.QuadPart < headerSize + labelBytes) {
+		unmap();
+		return;
+	}
+	m_fileMapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_fileMapping != nullptr) {
+		m_mapping = MapViewOfFile(m_fileMapping, FILE_MAP_READ, 0, 0, 0);
+		m_mappingSize = (size_t)fileSize.QuadPart;
+	}
+#else
+	m_file = open(fileName, O_RDONLY);
+	struct stat fileStat;
+	if (m_file < 0 || fstat(m_file, &fileStat) != 0 ||
+		(unsigned long long)fileStat.st_size < headerSize + labelBytes) {
+		unmap();
+		return;
+	}
+	void *mapping = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+	if (mapping != MAP_FAILED) {
+		m_mapping = mapping;
+		m_mappingSize = (size_t)fileStat.st_size;
+		madvise(m_mapping, m_mappingSize, MADV_SEQUENTIAL);
+	}
+#endif
+	if (m_mapping == nullptr) {
+		unmap();
+		return;
+	}
+
+	// The mapping is page aligned, so labels are aligned if the header size is a 
+	// multiple of the label size. Otherwise they are copied to aligned memory.
+	const unsigned char *labels = (const unsigned char *)m_mapping + headerSize;
+	if (headerSize % MMCellMap::labelSize(labelType) != 0) {
+		try {
+			m_labelCopy = new unsigned char[labelBytes];
+		}
+		catch (std::bad_alloc& ba) {
+			unmap();
+			return;
+		}
+		std::copy(labels, labels + labelBytes, m_labelCopy);
+		unmap();
+		labels = m_labelCopy;
+	}
+	m_labels = labels;
+	m_phaseStats[(int)Phase::Map] = endPhase(timer);
+}
+MMRawVolume::~MMRawVolume()
+{
+	unmap();
+	if (m_labelCopy) delete[] m_labelCopy;
+}
+bool MMRawVolume::isValid()
+{
+	return m_labels != nullptr;
+}
+
+// Labels in the mapped file
+const void *MMRawVolume::labels()
+{
+	return m_labels;
+}
+MMRawVolume::LabelType MMRawVolume::labelType()
+{
+	return m_labelType;
+}
+void MMRawVolume::getArraySize(int arraySize[3])
+{
+	arraySize[0] = m_arraySize[0];
+	arraySize[1] = m_arraySize[1];
+	arraySize[2] = m_arraySize[2];
+}
+
+// Read the file by touching one byte per page in order. Copied labels are already in
+// memory.
+void MMRawVolume::pageIn()
+{
+	if (!isValid() || m_mapping == nullptr) return;
+	PhaseTimer timer;
+	startPhase(timer);
+#if defined(_WIN32)
+	WIN32_MEMORY_RANGE_ENTRY range = { m_mapping, m_mappingSize };
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	size_t pageSize = systemInfo.dwPageSize;
+#else
+	madvise(m_mapping, m_mappingSize, MADV_WILLNEED);
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	const volatile unsigned char *bytes = (const volatile unsigned char *)m_mapping;
+	unsigned char sum = 0;
+	for (size_t offset = 0; offset < m_mappingSize; offset += pageSize) sum += bytes[offset];
+	(void)sum;
+	m_phaseStats[(int)Phase::PageIn] = endPhase(timer);
+}
+
+// Make a SurfaceNet over the mapped labels
+MMSurfaceNet *MMRawVolume::createSurfaceNet(float voxelSize[3], MMSurfaceNet::VertexOrder vertexOrder)
+{
+	if (!isValid()) return nullptr;
+	PhaseTimer timer;
+	startPhase(timer);
+	MMSurfaceNet *surfaceNet = nullptr;
+	MMSurfaceNet::LabelStorage labelStorage = MMSurfaceNet::LabelStorage::ReferenceLabels;
+	switch (m_labelType) {
+	case LabelType::UInt8:
+		surfaceNet = new MMSurfaceNet(m_labels, m_arraySize, voxelSize, labelStorage, vertexOrder);
+		break;
+	case LabelType::UInt32:
+		surfaceNet = new MMSurfaceNet((const unsigned int *)m_labels, m_arraySize, voxelSize,
+			labelStorage, vertexOrder);
+		break;
+	default:
+		surfaceNet = new MMSurfaceNet((const unsigned short *)m_labels, m_arraySize, voxelSize,
+			labelStorage, vertexOrder);
+		break;
+	}
+	m_phaseStats[(int)Phase::Construction] = endPhase(timer);
+	return surfaceNet;
+}
+
+// Loading statistics
+MMRawVolume::PhaseStats MMRawVolume::phaseStats(Phase phase)
+{
+	return m_phaseStats[(int)phase];
+}
+
+void MMRawVolume::unmap()
+{
+#if defined(_WIN32)
+	if (m_mapping) UnmapViewOfFile(m_mapping);
+	if (m_fileMapping) CloseHandle(m_fileMapping);
+	if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+	m_fileMapping = nullptr;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (m_mapping) munmap(m_mapping, m_mappingSize);
+	if (m_file >= 0) close(m_file);
+	m_file = -1;
+#endif
+	m_mapping = nullptr;
+	m_mappingSize = 0;
+	m_labels = nullptr;
+}
+
+// Wall-clock time and process page fault counts are sampled at the start and end of
+// each phase
+static double currentTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+void MMRawVolume::getPageFaults(size_t &numPageFaults, size_t &numMajorPageFaults)
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	numPageFaults = 0;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		numPageFaults = counters.PageFaultCount;
+	}
+	numMajorPageFaults = 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	numMajorPageFaults = (size_t)usage.ru_majflt;
+	numPageFaults = (size_t)usage.ru_minflt + numMajorPageFaults;
+#endif
+}
+void MMRawVolume::startPhase(PhaseTimer &timer)
+{
+	timer.startTime = currentTime();
+	getPageFaults(timer.startPageFaults, timer.startMajorPageFaults);
+}
+MMRawVolume::PhaseStats MMRawVolume::endPhase(const PhaseTimer &timer)
+{
+	PhaseStats stats;
+	size_t numPageFaults, numMajorPageFaults;
+	getPageFaults(numPageFaults, numMajorPageFaults);
+	stats.seconds = currentTime() - timer.startTime;
+	stats.numPageFaults = numPageFaults - timer.startPageFaults;
+	stats.numMajorPageFaults = numMajorPageFaults - timer.startMajorPageFaults;
+	return stats;
+}
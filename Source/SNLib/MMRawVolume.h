@@ -0,0 +1,87 @@
+// MMRawVolume.h
+//
+// Interface for MMRawVolume, which memory-maps a raw label file so that SurfaceNets
+// can be built over the file's labels without reading them into memory first
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#ifndef MM_RAW_VOLUME_H
+#define MM_RAW_VOLUME_H
+
+#include <cstddef>
+
+#include "MMSurfaceNet.h"
+
+class MMRawVolume
+{
+public:
+	// Map a raw file holding a 3D array of labels of type labelType after headerSize
+	// bytes. The file is mapped read-only and read sequentially as pages are touched. 
+	// Labels are read in their own type, so they must be aligned to the label size; if
+	// headerSize is not a multiple of the label size, the labels are copied into memory
+	// instead and the file is closed. If the file cannot be mapped or is too small, or 
+	// the copy cannot be allocated, isValid() returns false.
+	typedef MMSurfaceNet::LabelType LabelType;
+	MMRawVolume(const char *fileName, LabelType labelType, int arraySize[3], size_t headerSize = 0);
+	~MMRawVolume();
+	bool isValid();
+
+	// Labels in the mapped file, valid for the lifetime of the raw volume
+	const void *labels();
+	LabelType labelType();
+	void getArraySize(int arraySize[3]);
+
+	// Read the whole file into the page cache ahead of surface construction. Without
+	// this, pages are read while the SurfaceNet is constructed.
+	void pageIn();
+
+	// Make a SurfaceNet that references the mapped labels (LabelStorage::ReferenceLabels),
+	// so labels are not copied. The raw volume must outlive the SurfaceNet. Returns
+	// nullptr if the raw volume is not valid.
+	MMSurfaceNet *createSurfaceNet(float voxelSize[3],
+		MMSurfaceNet::VertexOrder vertexOrder = MMSurfaceNet::VertexOrder::ScanOrder);
+
+	// Wall-clock time and page faults of each phase of loading, so that time spent
+	// reading the file can be separated from time spent constructing the SurfaceNet.
+	// Page faults are counted for the whole process, so they include faults on memory
+	// allocated during the phase. Major page faults are faults that required reading 
+	// from disk; they are not reported separately on Windows, where all faults are 
+	// counted as page faults.
+	enum class Phase { Map, PageIn, Construction };
+	struct PhaseStats {
+		double seconds;
+		size_t numPageFaults;
+		size_t numMajorPageFaults;
+	};
+	PhaseStats phaseStats(Phase phase);
+
+private:
+	LabelType m_labelType;
+	int m_arraySize[3];
+	const unsigned char *m_labels;
+
+	// Mapping of the whole file. The labels start headerSize bytes into the mapping, or
+	// are in m_labelCopy if they would not be aligned.
+	unsigned char *m_labelCopy;
+	void *m_mapping;
+	size_t m_mappingSize;
+#if defined(_WIN32)
+	void *m_file;
+	void *m_fileMapping;
+#else
+	int m_file;
+#endif
+	void unmap();
+
+	PhaseStats m_phaseStats[3];
+	struct PhaseTimer {
+		double startTime;
+		size_t startPageFaults;
+		size_t startMajorPageFaults;
+	};
+	static void getPageFaults(size_t &numPageFaults, size_t &numMajorPageFaults);
+	static void startPhase(PhaseTimer &timer);
+	static PhaseStats endPhase(const PhaseTimer &timer);
+};
+
+#endif
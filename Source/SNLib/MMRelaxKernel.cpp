@@ -0,0 +1,263 @@
+// MMRelaxKernel.cpp
+//
+// MMRelaxKernel implementation
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <cstddef>
+#include "MMRelaxKernel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MM_RELAX_KERNEL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MM_TARGET_AVX2
+#else
+#define MM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+//
+// Scalar reference implementation. Each vertex is moved towards the average position
+// of its neighbors and constrained to a maximum distance from its cell center. The 
+// SIMD implementations perform the same float operations in the same order for each
+// vertex so that all instruction sets give identical results.
+//
+static inline void relaxVertexScalar(const MMRelaxKernel::VertexData &vertexData, int idxVtx,
+	float alpha, float min, float max, const float *srcOffsets, float *dstOffsets)
+{
+	const float *p = &srcOffsets[3 * idxVtx];
+	float *relaxedP = &dstOffsets[3 * idxVtx];
+	int nbrBegin = vertexData.nbrBegin[idxVtx];
+	int numNeighbors = vertexData.nbrBegin[idxVtx + 1] - nbrBegin;
+	if (numNeighbors == 0) {
+		relaxedP[0] = p[0];
+		relaxedP[1] = p[1];
+		relaxedP[2] = p[2];
+		return;
+	}
+	float oneMinusAlpha = 1.0f - alpha;
+	const int *pNbr = &vertexData.nbrIndices[nbrBegin];
+	float sumP[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < numNeighbors; i++) {
+		const float *nbrP = &srcOffsets[3 * pNbr[i]];
+		sumP[0] += nbrP[0];
+		sumP[1] += nbrP[1];
+		sumP[2] += nbrP[2];
+	}
+	const float *deltaSum = &vertexData.nbrCellDeltaSums[3 * idxVtx];
+	for (int c = 0; c < 3; c++) {
+		float avgP = (sumP[c] + deltaSum[c]) / (float)numNeighbors;
+		float q = oneMinusAlpha * p[c] + alpha * avgP;
+		if (q < min) q = min;
+		if (q > max) q = max;
+		relaxedP[c] = q;
+	}
+}
+static void relaxScalar(const MMRelaxKernel::VertexData &vertexData, const int *vertexIndices, 
+	int begin, int end, float relaxFactor, float maxDistFromCellCenter, const float *srcOffsets, 
+	float *dstOffsets)
+{
+	float min = 0.5f - maxDistFromCellCenter;
+	float max = 0.5f + maxDistFromCellCenter;
+	for (int i = begin; i < end; i++) {
+		int idxVtx = vertexIndices ? vertexIndices[i] : i;
+		relaxVertexScalar(vertexData, idxVtx, relaxFactor, min, max, srcOffsets, dstOffsets);
+	}
+}
+
+#ifdef MM_RELAX_KERNEL_X86
+
+//
+// SSE2 implementation. SSE2 has no gather instructions, so each vertex is relaxed with
+// its x, y and z offsets in the first three lanes of a vector.
+//
+static inline __m128 loadOffset(const float *p)
+{
+	__m128 xy = _mm_castpd_ps(_mm_load_sd((const double *)p));
+	__m128 z = _mm_load_ss(p + 2);
+	return _mm_movelh_ps(xy, z);
+}
+static void relaxSSE2(const MMRelaxKernel::VertexData &vertexData, const int *vertexIndices, 
+	int begin, int end, float relaxFactor, float maxDistFromCellCenter, const float *srcOffsets, 
+	float *dstOffsets)
+{
+	const __m128 alpha = _mm_set1_ps(relaxFactor);
+	const __m128 oneMinusAlpha = _mm_set1_ps(1.0f - relaxFactor);
+	const __m128 min = _mm_set1_ps(0.5f - maxDistFromCellCenter);
+	const __m128 max = _mm_set1_ps(0.5f + maxDistFromCellCenter);
+	for (int idx = begin; idx < end; idx++) {
+		int idxVtx = vertexIndices ? vertexIndices[idx] : idx;
+		const float *p = &srcOffsets[3 * idxVtx];
+		float *relaxedP = &dstOffsets[3 * idxVtx];
+		int nbrBegin = vertexData.nbrBegin[idxVtx];
+		int numNeighbors = vertexData.nbrBegin[idxVtx + 1] - nbrBegin;
+		if (numNeighbors == 0) {
+			relaxedP[0] = p[0];
+			relaxedP[1] = p[1];
+			relaxedP[2] = p[2];
+			continue;
+		}
+		const int *pNbr = &vertexData.nbrIndices[nbrBegin];
+		__m128 sumP = _mm_setzero_ps();
+		for (int i = 0; i < numNeighbors; i++) {
+			sumP = _mm_add_ps(sumP, loadOffset(&srcOffsets[3 * pNbr[i]]));
+		}
+		__m128 deltaSum = loadOffset(&vertexData.nbrCellDeltaSums[3 * idxVtx]);
+		__m128 avgP = _mm_div_ps(_mm_add_ps(sumP, deltaSum), _mm_set1_ps((float)numNeighbors));
+		__m128 q = _mm_add_ps(_mm_mul_ps(oneMinusAlpha, loadOffset(p)), _mm_mul_ps(alpha, avgP));
+		q = _mm_min_ps(_mm_max_ps(q, min), max);
+		float relaxed[4];
+		_mm_storeu_ps(relaxed, q);
+		relaxedP[0] = relaxed[0];
+		relaxedP[1] = relaxed[1];
+		relaxedP[2] = relaxed[2];
+	}
+}
+
+//
+// AVX2 implementation. Eight vertices are relaxed at a time using masked gathers to
+// load neighbor indices and positions. Vertices from a vertex list are also gathered.
+//
+MM_TARGET_AVX2
+static void relaxAVX2(const MMRelaxKernel::VertexData &vertexData, const int *vertexIndices, 
+	int begin, int end, float relaxFactor, float maxDistFromCellCenter, const float *srcOffsets, 
+	float *dstOffsets)
+{
+	const __m256 alpha = _mm256_set1_ps(relaxFactor);
+	const __m256 oneMinusAlpha = _mm256_set1_ps(1.0f - relaxFactor);
+	const __m256 min = _mm256_set1_ps(0.5f - maxDistFromCellCenter);
+	const __m256 max = _mm256_set1_ps(0.5f + maxDistFromCellCenter);
+	int idx = begin;
+	for (; idx + 8 <= end; idx += 8) {
+		__m256i vtx, nbrBegin, nbrEnd;
+		if (vertexIndices) {
+			vtx = _mm256_loadu_si256((const __m256i *)&vertexIndices[idx]);
+			nbrBegin = _mm256_i32gather_epi32(vertexData.nbrBegin, vtx, 4);
+			nbrEnd = _mm256_i32gather_epi32(vertexData.nbrBegin + 1, vtx, 4);
+		}
+		else {
+			vtx = _mm256_add_epi32(_mm256_set1_epi32(idx), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+			nbrBegin = _mm256_loadu_si256((const __m256i *)&vertexData.nbrBegin[idx]);
+			nbrEnd = _mm256_loadu_si256((const __m256i *)&vertexData.nbrBegin[idx + 1]);
+		}
+		__m256i numNbrs = _mm256_sub_epi32(nbrEnd, nbrBegin);
+		int numNeighbors[8];
+		_mm256_storeu_si256((__m256i *)numNeighbors, numNbrs);
+		int maxNumNeighbors = 0;
+		for (int lane = 0; lane < 8; lane++) {
+			if (numNeighbors[lane] > maxNumNeighbors) maxNumNeighbors = numNeighbors[lane];
+		}
+
+		// Sum neighbor positions
+		__m256 sum[3] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+		for (int i = 0; i < maxNumNeighbors; i++) {
+			__m256i iv = _mm256_set1_epi32(i);
+			__m256i isActive = _mm256_cmpgt_epi32(numNbrs, iv);
+			__m256i nbr = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), 
+				vertexData.nbrIndices, _mm256_add_epi32(nbrBegin, iv), isActive, 4);
+			__m256i nbrOffset = _mm256_add_epi32(nbr, _mm256_add_epi32(nbr, nbr));
+			__m256 mask = _mm256_castsi256_ps(isActive);
+			for (int c = 0; c < 3; c++) {
+				__m256 nbrP = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), srcOffsets + c,
+					nbrOffset, mask, 4);
+				sum[c] = _mm256_blendv_ps(sum[c], _mm256_add_ps(sum[c], nbrP), mask);
+			}
+		}
+
+		// Relax towards the average position and constrain to the cell neighborhood
+		__m256 hasNbrs = _mm256_castsi256_ps(_mm256_cmpgt_epi32(numNbrs, _mm256_setzero_si256()));
+		__m256 n = _mm256_cvtepi32_ps(numNbrs);
+		__m256i vtxOffset = _mm256_add_epi32(vtx, _mm256_add_epi32(vtx, vtx));
+		float relaxed[3][8];
+		for (int c = 0; c < 3; c++) {
+			__m256 p = _mm256_i32gather_ps(srcOffsets + c, vtxOffset, 4);
+			__m256 d = _mm256_i32gather_ps(vertexData.nbrCellDeltaSums + c, vtxOffset, 4);
+			__m256 avgP = _mm256_div_ps(_mm256_add_ps(sum[c], d), n);
+			__m256 q = _mm256_add_ps(_mm256_mul_ps(oneMinusAlpha, p), _mm256_mul_ps(alpha, avgP));
+			q = _mm256_min_ps(_mm256_max_ps(q, min), max);
+			q = _mm256_blendv_ps(p, q, hasNbrs);
+			_mm256_storeu_ps(relaxed[c], q);
+		}
+		int vtxIndex[8];
+		_mm256_storeu_si256((__m256i *)vtxIndex, vtx);
+		for (int lane = 0; lane < 8; lane++) {
+			float *dst = &dstOffsets[3 * vtxIndex[lane]];
+			dst[0] = relaxed[0][lane];
+			dst[1] = relaxed[1][lane];
+			dst[2] = relaxed[2][lane];
+		}
+	}
+	relaxScalar(vertexData, vertexIndices, idx, end, relaxFactor, maxDistFromCellCenter, 
+		srcOffsets, dstOffsets);
+}
+
+#endif
+
+//
+// MMRelaxKernel implementation
+//
+MMRelaxKernel::InstructionSet MMRelaxKernel::bestInstructionSet()
+{
+#ifdef MM_RELAX_KERNEL_X86
+#if defined(_MSC_VER)
+	// AVX2 requires processor support and operating system support for saving AVX 
+	// registers
+	int regs[4];
+	__cpuid(regs, 0);
+	int maxFunction = regs[0];
+	__cpuid(regs, 1);
+	bool hasSSE2 = (regs[3] & (1 << 26)) != 0;
+	bool hasOSXSAVE = (regs[2] & (1 << 27)) != 0;
+	bool hasAVX = (regs[2] & (1 << 28)) != 0;
+	if (maxFunction >= 7 && hasOSXSAVE && hasAVX && (_xgetbv(0) & 0x6) == 0x6) {
+		__cpuidex(regs, 7, 0);
+		if ((regs[1] & (1 << 5)) != 0) return InstructionSet::AVX2;
+	}
+	if (hasSSE2) return InstructionSet::SSE2;
+#else
+	if (__builtin_cpu_supports("avx2")) return InstructionSet::AVX2;
+	if (__builtin_cpu_supports("sse2")) return InstructionSet::SSE2;
+#endif
+#endif
+	return InstructionSet::Scalar;
+}
+
+static void relaxVertices(MMRelaxKernel::InstructionSet instructionSet, 
+	const MMRelaxKernel::VertexData &vertexData, const int *vertexIndices, int begin, int end, 
+	float relaxFactor, float maxDistFromCellCenter, const float *srcOffsets, float *dstOffsets)
+{
+	switch (instructionSet) {
+#ifdef MM_RELAX_KERNEL_X86
+	case MMRelaxKernel::InstructionSet::AVX2:
+		relaxAVX2(vertexData, vertexIndices, begin, end, relaxFactor, maxDistFromCellCenter, 
+			srcOffsets, dstOffsets);
+		break;
+	case MMRelaxKernel::InstructionSet::SSE2:
+		relaxSSE2(vertexData, vertexIndices, begin, end, relaxFactor, maxDistFromCellCenter, 
+			srcOffsets, dstOffsets);
+		break;
+#endif
+	default:
+		relaxScalar(vertexData, vertexIndices, begin, end, relaxFactor, maxDistFromCellCenter, 
+			srcOffsets, dstOffsets);
+		break;
+	}
+}
+
+void MMRelaxKernel::relax(InstructionSet instructionSet, const VertexData &vertexData,
+	int begin, int end, float relaxFactor, float maxDistFromCellCenter,
+	const float *srcOffsets, float *dstOffsets)
+{
+	relaxVertices(instructionSet, vertexData, NULL, begin, end, relaxFactor, 
+		maxDistFromCellCenter, srcOffsets, dstOffsets);
+}
+
+void MMRelaxKernel::relaxList(InstructionSet instructionSet, const VertexData &vertexData,
+	const int *vertexIndices, int numVertices, float relaxFactor, float maxDistFromCellCenter,
+	const float *srcOffsets, float *dstOffsets)
+{
+	relaxVertices(instructionSet, vertexData, vertexIndices, 0, numVertices, relaxFactor, 
+		maxDistFromCellCenter, srcOffsets, dstOffsets);
+}
\ No newline at end of file
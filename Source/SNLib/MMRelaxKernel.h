@@ -0,0 +1,43 @@
+// MMRelaxKernel.h
+//
+// Interface for MMRelaxKernel, which relaxes a range or list of SurfaceNet vertices 
+// for one Jacobi iteration. Vertex offsets are read from one array and written to another,
+// so vertices are independent and can be processed with SIMD instructions. The 
+// instruction set is chosen at run time; all instruction sets give identical results.
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#ifndef MM_RELAX_KERNEL_H
+#define MM_RELAX_KERNEL_H
+
+class MMRelaxKernel
+{
+public:
+	enum class InstructionSet { Scalar, SSE2, AVX2 };
+
+	// Vertex data used by the kernel. Offsets are stored as [x0, y0, z0, x1, ...] in
+	// voxel units relative to each vertex's cell. Neighbors are stored in compressed
+	// sparse row form (see MMCellMap).
+	struct VertexData {
+		const int *nbrBegin;
+		const int *nbrIndices;
+		const float *nbrCellDeltaSums;
+	};
+
+	// Fastest instruction set supported by this processor
+	static InstructionSet bestInstructionSet();
+
+	// Relax vertices [begin, end) from srcOffsets into dstOffsets. The Scalar
+	// instruction set is a reference implementation that can be used for validation.
+	static void relax(InstructionSet instructionSet, const VertexData &vertexData, 
+		int begin, int end, float relaxFactor, float maxDistFromCellCenter, 
+		const float *srcOffsets, float *dstOffsets);
+
+	// Relax the numVertices vertices listed in vertexIndices from srcOffsets into 
+	// dstOffsets. Offsets of vertices that are not listed are not written.
+	static void relaxList(InstructionSet instructionSet, const VertexData &vertexData, 
+		const int *vertexIndices, int numVertices, float relaxFactor, 
+		float maxDistFromCellCenter, const float *srcOffsets, float *dstOffsets);
+};
+
+#endif
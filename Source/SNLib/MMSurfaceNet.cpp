@@ -8,69 +8,154 @@
 #include <algorithm>
 #include <time.h>
 #include <string>
-#include <set>
 
 #include "MMSurfaceNet.h"
 #include "MMCellMap.h"
 #include "MMGeometryGL.h"
 #include "MMGeometryOBJ.h"
 
-MMSurfaceNet::MMSurfaceNet(unsigned short* labels, int arraySize[3], float voxelSize[3]) :
-	m_cellMap(nullptr)
+MMSurfaceNet::MMSurfaceNet(const unsigned char* labels, int arraySize[3], float voxelSize[3],
+	LabelStorage labelStorage, VertexOrder vertexOrder) :
+	MMSurfaceNet(labels, LabelType::UInt8, arraySize, voxelSize, labelStorage, vertexOrder)
+{
+}
+MMSurfaceNet::MMSurfaceNet(const unsigned short* labels, int arraySize[3], float voxelSize[3],
+	LabelStorage labelStorage, VertexOrder vertexOrder) :
+	MMSurfaceNet(labels, LabelType::UInt16, arraySize, voxelSize, labelStorage, vertexOrder)
+{
+}
+MMSurfaceNet::MMSurfaceNet(const unsigned int* labels, int arraySize[3], float voxelSize[3],
+	LabelStorage labelStorage, VertexOrder vertexOrder) :
+	MMSurfaceNet(labels, LabelType::UInt32, arraySize, voxelSize, labelStorage, vertexOrder)
+{
+}
+MMSurfaceNet::MMSurfaceNet(const void* labels, LabelType labelType, int arraySize[3], 
+	float voxelSize[3], LabelStorage labelStorage, VertexOrder vertexOrder) :
+	m_cellMap(nullptr),
+	m_labelType(labelType),
+	m_isRelaxStateKnown(true),
+	m_relaxStateAttrs(),
+	m_numRelaxIterationsApplied(0)
 {
 	if (m_cellMap != NULL) delete m_cellMap;
-	m_cellMap = new MMCellMap(labels, arraySize, voxelSize);
+	m_cellMap = new MMCellMap(labels, labelType, arraySize, voxelSize, labelStorage, 
+		vertexOrder);
 }
 MMSurfaceNet::~MMSurfaceNet()
 {
 	// Delete cellMap if it exists
 	if (m_cellMap) delete m_cellMap;
 }
+bool MMSurfaceNet::isValid()
+{
+	return m_cellMap != nullptr && m_cellMap->isValid();
+}
 
 // Surface smoothing (relaxation)
-void MMSurfaceNet::relax(const RelaxAttrs relaxAttrs)
+MMSurfaceNet::RelaxStats MMSurfaceNet::relax(const RelaxAttrs relaxAttrs)
 {
-	if (!m_cellMap) return;
-	m_cellMap->relax(relaxAttrs);
+	if (!m_cellMap) return RelaxStats();
+	m_isRelaxStateKnown = false;
+	return m_cellMap->relax(relaxAttrs);
 }
 void MMSurfaceNet::reset()
 {
 	if (!m_cellMap) return;
 	m_cellMap->reset();
+	m_isRelaxStateKnown = true;
+	m_numRelaxIterationsApplied = 0;
 }
 
-std::vector<int> MMSurfaceNet::labels() 
-{
-	std::vector<int> labels;
-	if (m_cellMap != nullptr) {
-		// Find the unique material labels
-		std::set<int> labelSet;
-		for (int idxVtx = 0; idxVtx < m_cellMap->numVertices(); idxVtx++) {
-			int vertexIndices[4];
-			unsigned short quadLabels[2];
+// Relaxation with state
+MMSurfaceNet::RelaxStats MMSurfaceNet::relaxTo(const RelaxAttrs relaxAttrs)
+{
+	if (!m_cellMap) return RelaxStats();
+	if (!canContinueRelaxation(relaxAttrs)) {
+		reset();
+	}
+	else if (m_numRelaxIterationsApplied > 0 && 
+		m_numRelaxIterationsApplied < m_relaxStateAttrs.numRelaxIterations) {
+		// The last relaxation converged before applying all of its iterations. Allowing
+		// more iterations would converge at the same iteration and give the same result.
+		m_relaxStateAttrs = relaxAttrs;
+		return RelaxStats();
+	}
+	RelaxAttrs remainingAttrs = relaxAttrs;
+	remainingAttrs.numRelaxIterations -= m_numRelaxIterationsApplied;
+	RelaxStats stats = m_cellMap->relax(remainingAttrs);
+	m_isRelaxStateKnown = true;
+	m_relaxStateAttrs = relaxAttrs;
+	m_numRelaxIterationsApplied += stats.numIterations;
+	return stats;
+}
+int MMSurfaceNet::numRelaxIterationsApplied()
+{
+	return m_isRelaxStateKnown ? m_numRelaxIterationsApplied : -1;
+}
 
-			// Back-bottom edge
-			if (m_cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::BackBottomEdge, vertexIndices, quadLabels) == true) {
-				labelSet.insert((int)quadLabels[0]);
-				labelSet.insert((int)quadLabels[1]);
-			}
+// Relaxation can continue from the current state if no iterations have been applied or
+// if the new attributes differ only by more iterations. The number of threads does not 
+// affect the result. 
+bool MMSurfaceNet::canContinueRelaxation(const RelaxAttrs &relaxAttrs)
+{
+	if (!m_isRelaxStateKnown) return false;
+	if (m_numRelaxIterationsApplied == 0) return true;
+	const RelaxAttrs &prevAttrs = m_relaxStateAttrs;
+	return relaxAttrs.numRelaxIterations >= m_numRelaxIterationsApplied &&
+		relaxAttrs.relaxFactor == prevAttrs.relaxFactor &&
+		relaxAttrs.maxDistFromCellCenter == prevAttrs.maxDistFromCellCenter &&
+		relaxAttrs.relaxMethod == prevAttrs.relaxMethod &&
+		relaxAttrs.convergenceTolerance == prevAttrs.convergenceTolerance &&
+		relaxAttrs.convergenceNorm == prevAttrs.convergenceNorm &&
+		relaxAttrs.activeSetEpsilon <= 0 && prevAttrs.activeSetEpsilon <= 0;
+}
 
-			// Left-bottom edge
-			if (m_cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::LeftBottomEdge, vertexIndices, quadLabels) == true) {
-				labelSet.insert(quadLabels[0]);
-				labelSet.insert(quadLabels[1]);
-			}
+size_t MMSurfaceNet::memorySize()
+{
+	if (!m_cellMap) return 0;
+	return sizeof(MMSurfaceNet) + sizeof(MMCellMap) + m_cellMap->memorySize();
+}
+size_t MMSurfaceNet::labelMemorySize()
+{
+	if (!m_cellMap) return 0;
+	return m_cellMap->labelMemorySize();
+}
 
-			// Left-back edge
-			if (m_cellMap->getEdgeQuad(idxVtx, MMCellFlag::Edge::LeftBackEdge, vertexIndices, quadLabels) == true) {
-				labelSet.insert(quadLabels[0]);
-				labelSet.insert(quadLabels[1]);
-			}
-		}
-		// Removed the reserved padding index
-		labelSet.erase(ReservedLabel::Pading);
-		labels.assign(labelSet.begin(), labelSet.end());
+// Labels and label statistics are computed by the cell map during construction
+std::vector<unsigned int> MMSurfaceNet::labels() 
+{
+	std::vector<unsigned int> labels;
+	const std::vector<LabelStats> &stats = labelStats();
+	for (std::vector<LabelStats>::const_iterator itStats = stats.begin(); itStats != stats.end(); itStats++) {
+		labels.push_back(itStats->label);
 	}
-
 	return labels;
 }
+const std::vector<MMSurfaceNet::LabelStats> &MMSurfaceNet::labelStats()
+{
+	static const std::vector<LabelStats> noLabelStats;
+	if (!m_cellMap) return noLabelStats;
+	return m_cellMap->labelStats();
+}
+bool MMSurfaceNet::getLabelStats(unsigned int label, LabelStats &stats)
+{
+	int idxLabel = labelIndex(label);
+	if (idxLabel < 0) return false;
+	stats = m_cellMap->labelStats()[idxLabel];
+	return true;
+}
+int MMSurfaceNet::labelIndex(unsigned int label)
+{
+	if (!m_cellMap) return -1;
+	return m_cellMap->labelIndex(label);
+}
+
+// Label type and reserved padding label
+MMSurfaceNet::LabelType MMSurfaceNet::labelType()
+{
+	return m_labelType;
+}
+unsigned int MMSurfaceNet::paddingLabel()
+{
+	return MMCellMap::paddingLabel(m_labelType);
+}
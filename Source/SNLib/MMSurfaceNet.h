@@ -6,7 +6,8 @@
 //
 // MMSurfaceNet
 // A free, open-source C++ implementation of 3D SurfaceNets that supports multiple
-// materials (up to 62235) represented as indexed labels (0 to 65534)
+// materials represented as indexed labels (8, 16 or 32-bit, e.g., 0 to 65534 for
+// 16-bit labels)
 //  
 // Disclaimer
 // The Software is provided "AS IS" and neither Brigham nor any
@@ -55,29 +56,156 @@ class MMCellMap;
 class MMSurfaceNet
 {
 public:
-	MMSurfaceNet(unsigned short* labels, int arraySize[3], float voxelSize[3]);
+	// Labels are stored as a 3D array indexed by x + arraySize[0] * (y + arraySize[1] * z).
+	// Labels can be 8, 16 or 32-bit unsigned integers and are read in their own type. The
+	// largest value of the label type (255, 65535 or 4294967295) is reserved for padding
+	// and is not available as a material label.
+	//
+	// By default the SurfaceNet makes its own copy of the labels. With ReferenceLabels, 
+	// no copy is made and labels are read directly from the caller's array, which 
+	// halves peak memory for large volumes. The caller keeps ownership of the array and
+	// must keep it valid and unchanged for the lifetime of the SurfaceNet, because 
+	// labels are also read when surfaces are exported (labels(), MMGeometryGL and 
+	// MMGeometryOBJ). Volume faces are padded with the reserved label without 
+	// modifying or copying the array.
+	//
+	// With CompressLabels, labels are copied into bricks of 8 x 8 x 8 voxels that store
+	// each of their distinct labels once and a 0, 1, 2, 4, 8 or 16-bit palette index per 
+	// voxel. Segmentations with few labels per neighborhood typically need well under 1
+	// bit per voxel, at the cost of decoding labels when they are read.
+	//
+	// Vertices are numbered in ScanOrder (x fastest, then y, then z) by default. With
+	// BrickOrder, vertices are numbered brick by brick in bricks of 8 x 8 x 8 cells and
+	// in Morton (Z-order) within each brick, so that vertices in neighboring cells,
+	// including neighbors in z, are usually close together in memory. Vertices are sorted
+	// once per slab of bricks during construction, which adds about 5 to 20% to the
+	// construction time. In scan order, neighbors are read as a few sequential streams
+	// that processors prefetch well, so relaxation and export are at least as fast as with
+	// BrickOrder, and ScanOrder is recommended. Jacobi relaxation and exported surfaces are
+	// the same for both orders, apart from the order of vertices and quads; sequential
+	// relaxation updates vertices in vertex order, so its results differ slightly.
+	enum class LabelStorage { CopyLabels, ReferenceLabels, CompressLabels };
+	enum class LabelType { UInt8, UInt16, UInt32 };
+	enum class VertexOrder { ScanOrder, BrickOrder };
+	MMSurfaceNet(const unsigned char* labels, int arraySize[3], float voxelSize[3],
+		LabelStorage labelStorage = LabelStorage::CopyLabels,
+		VertexOrder vertexOrder = VertexOrder::ScanOrder);
+	MMSurfaceNet(const unsigned short* labels, int arraySize[3], float voxelSize[3],
+		LabelStorage labelStorage = LabelStorage::CopyLabels,
+		VertexOrder vertexOrder = VertexOrder::ScanOrder);
+	MMSurfaceNet(const unsigned int* labels, int arraySize[3], float voxelSize[3],
+		LabelStorage labelStorage = LabelStorage::CopyLabels,
+		VertexOrder vertexOrder = VertexOrder::ScanOrder);
 	~MMSurfaceNet();
 
-	// Surface smoothing (relaxation)
+	// False if the SurfaceNet could not be made because memory could not be allocated or
+	// because its surface has more vertices than 32-bit vertex indices allow, in which
+	// case it is empty. A valid SurfaceNet is empty if the volume has no surfaces.
+	bool isValid();
+
+	// Surface smoothing (relaxation). Sequential relaxation updates vertices in place 
+	// in vertex order (Gauss-Seidel) on a single thread. Jacobi relaxation computes 
+	// each iteration from the positions of the previous iteration, so it can be split 
+	// across threads and gives identical results for any number of threads.
+	//
+	// If convergenceTolerance is positive, relaxation stops early once the vertex 
+	// displacement of an iteration, measured as the maximum or root-mean-square 
+	// displacement over all vertices in voxel units, falls below the tolerance. At 
+	// most numRelaxIterations iterations are applied.
+	//
+	// If activeSetEpsilon is positive, only the active set of vertices is relaxed in 
+	// each iteration. A vertex is active if it, or one of its neighbors, has moved more
+	// than epsilon (in voxel units) since it last did so. Other vertices are left in 
+	// place. Relaxation stops when no vertices are active. The number of vertices 
+	// relaxed in each iteration is reported in RelaxStats.
+	enum class RelaxMethod { Sequential, Jacobi };
+	enum class ConvergenceNorm { MaxDisplacement, RMSDisplacement };
 	struct RelaxAttrs {
 		int numRelaxIterations;	     // More iterations --> smoother and slower 
 		float relaxFactor;			 // Range (0.0, 1.0); larger --> faster but less stable
 		float maxDistFromCellCenter; // Maximun displacement of relaxed surface in voxel units
+		RelaxMethod relaxMethod;	 // Sequential or Jacobi
+		int numThreads;				 // Threads used by Jacobi relaxation; <= 0 uses all cores
+		float convergenceTolerance;	 // Stop when displacement < tolerance; <= 0 disables
+		ConvergenceNorm convergenceNorm; // Displacement measure used for convergence
+		float activeSetEpsilon;		 // Skip vertices whose neighborhood moved < epsilon; <= 0 disables
+	};
+	struct RelaxStats {
+		int numIterations;			 // Number of iterations applied
+		float residual;				 // Displacement of the last iteration in voxel units
+		std::vector<int> activeSetSizes; // Number of vertices relaxed in each iteration
 	};
-	void relax(const RelaxAttrs relaxAttrs);
+	RelaxStats relax(const RelaxAttrs relaxAttrs);
 	void reset();
 
-	// Get the unique material labels for this SurfaceNet
-	std::vector<int> labels();
+	// Relaxation with state. relaxTo() gives the same vertex positions as reset() 
+	// followed by relax(relaxAttrs), but remembers the attributes and number of 
+	// iterations applied since the last reset. When only numRelaxIterations has grown
+	// (or numThreads has changed), relaxation continues from the current positions and 
+	// only the additional iterations are applied; if the previous relaxation converged
+	// early, no iterations are needed. Otherwise the SurfaceNet is reset and relaxed from
+	// scratch. Active set relaxation always restarts from scratch because the active set
+	// is not kept between calls. The returned stats describe the iterations applied by 
+	// this call.
+	RelaxStats relaxTo(const RelaxAttrs relaxAttrs);
+	int numRelaxIterationsApplied();
+
+	// Get the unique material labels for this SurfaceNet, in increasing order. Labels 
+	// and their statistics are computed when the SurfaceNet is constructed, so these 
+	// queries do not scan the surface.
+	std::vector<unsigned int> labels();
+
+	// Statistics of each material label, in increasing order of label. Quads are 
+	// counted for the labels on both of their sides. Bounding boxes are given in voxel 
+	// indices of the label array, inclusive of the first and last voxel of the label.
+	// getLabelStats() returns false if the label is not in the SurfaceNet.
+	struct LabelStats {
+		unsigned int label;
+		size_t numQuads;			 // Surface quads bounding the label
+		size_t numVoxels;			 // Voxels with the label
+		int minVoxel[3];			 // Bounding box of voxels with the label
+		int maxVoxel[3];
+	};
+	const std::vector<LabelStats> &labelStats();
+	bool getLabelStats(unsigned int label, LabelStats &stats);
+
+	// Compact index of a label, i.e., its position in labels() and labelStats(), or -1 
+	// if the label is not in the SurfaceNet. Labels are usually looked up in a dense table,
+	// so this is fast enough for per-quad use when making geometry.
+	int labelIndex(unsigned int label);
 
-	// Label used internally. Not available as a material index.
+	// Type of the labels and the label reserved for padding
+	LabelType labelType();
+	unsigned int paddingLabel();
+
+	// Memory used by the SurfaceNet in bytes (e.g., divide by the number of voxels 
+	// for memory per voxel). Referenced labels are owned by the caller and not included.
+	size_t memorySize();
+
+	// Memory used to store labels in bytes, included in memorySize(). Dividing the size
+	// of the label array by this gives the compression ratio of compressed labels.
+	size_t labelMemorySize();
+
+	// Padding label for 16-bit labels. Not available as a material index. See 
+	// paddingLabel() for other label types.
 	enum ReservedLabel { Pading = 65535 };
 
 private:
 	friend class MMGeometryGL;
 	friend class MMGeometryOBJ;
 
+	MMSurfaceNet(const void* labels, LabelType labelType, int arraySize[3], float voxelSize[3],
+		LabelStorage labelStorage, VertexOrder vertexOrder);
+
 	MMCellMap *m_cellMap;
+	LabelType m_labelType;
+
+	// Relaxation applied since the last reset, used by relaxTo(). The state is unknown
+	// after relax() is called directly.
+	bool m_isRelaxStateKnown;
+	RelaxAttrs m_relaxStateAttrs;
+	int m_numRelaxIterationsApplied;
+	bool canContinueRelaxation(const RelaxAttrs &relaxAttrs);
 };
 
 #endif
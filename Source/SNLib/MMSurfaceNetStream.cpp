@@ -0,0 +1,183 @@
+// MMSurfaceNetStream.cpp
+//
+// MMSurfaceNetStream implementation
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <cstdio>
+#include <exception>
+#include <new>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+#endif
+
+#include "MMSurfaceNetStream.h"
+#include "MMCellMap.h"
+
+MMSurfaceNetStream::MMSurfaceNetStream(LabelType labelType, int arraySize[3], float voxelSize[3],
+	int slabSize) :
+	m_labelType(labelType),
+	m_slabSize(std::max(slabSize, 1)),
+	m_numVertices(0),
+	m_numQuads(0),
+	m_peakMemorySize(0)
+{
+	for (int i = 0; i < 3; i++) {
+		m_arraySize[i] = arraySize[i];
+		m_voxelSize[i] = voxelSize[i];
+	}
+}
+MMSurfaceNetStream::~MMSurfaceNetStream()
+{
+}
+
+// Surface the volume slab by slab. Slabs partition the slices of cells that can have
+// vertices (cells 0 to arraySize[2] of the padded cell grid). Each slab is surfaced in a
+// cell map of a window of label slices that extends haloSize slices beyond the slab on
+// either side; the window is padded like a volume, so cells near its faces may differ
+// from the cells of the whole volume.
+//
+// After n Jacobi iterations, a vertex depends only on the cells of vertices within n
+// neighbor steps, which are within n slices. Quads of the 3 edges used for export
+// connect cells in the same slice or in the slice below. With haloSize = n + 2, all cells
+// within n + 1 slices of the slab are the same as in the whole volume, so the slab's
+// vertices, quads and vertex numbering match those of the whole volume. Vertices are
+// numbered in scan order, so the window's vertices from the slice below the slab
+// precede the slab's vertices by the same amount as in the whole volume.
+bool MMSurfaceNetStream::surface(SliceReader sliceReader, MMSurfaceNet::RelaxAttrs relaxAttrs,
+	Sink &sink)
+{
+	m_numVertices = 0;
+	m_numQuads = 0;
+	m_peakMemorySize = 0;
+	relaxAttrs.numRelaxIterations = std::max(relaxAttrs.numRelaxIterations, 0);
+	relaxAttrs.relaxMethod = MMSurfaceNet::RelaxMethod::Jacobi;
+	relaxAttrs.convergenceTolerance = 0.0f;
+	relaxAttrs.activeSetEpsilon = 0.0f;
+	int haloSize = relaxAttrs.numRelaxIterations + 2;
+	int numSlices = m_arraySize[2];
+	size_t sliceBytes = (size_t)m_arraySize[0] * m_arraySize[1] * MMCellMap::labelSize(m_labelType);
+	int maxWindowSize = std::min(numSlices, m_slabSize + 2 * haloSize);
+	std::vector<unsigned char> window;
+	try {
+		window.resize(maxWindowSize * sliceBytes);
+	}
+	catch (std::bad_alloc& ba) {
+		return false;
+	}
+
+	int windowBegin = 0;
+	int windowEnd = 0;
+	for (int slabBegin = 0; slabBegin <= numSlices; slabBegin += m_slabSize) {
+		int slabEnd = std::min(slabBegin + m_slabSize, numSlices + 1);
+
+		// Keep the slices shared with the previous window and read the remaining slices
+		int begin = std::max(slabBegin - haloSize, 0);
+		int end = std::min(slabEnd + haloSize, numSlices);
+		if (begin < windowEnd) {
+			std::copy(window.begin() + (begin - windowBegin) * sliceBytes,
+				window.begin() + (windowEnd - windowBegin) * sliceBytes, window.begin());
+		}
+		else {
+			windowEnd = begin;
+		}
+		windowBegin = begin;
+		for (int k = windowEnd; k < end; k++) {
+			if (!sliceReader(k, &window[(k - begin) * sliceBytes])) return false;
+		}
+		windowEnd = end;
+
+		// Surface and relax the window
+		int windowSize[3] = { m_arraySize[0], m_arraySize[1], end - begin };
+		MMCellMap cellMap(window.data(), m_labelType, windowSize, m_voxelSize,
+			MMSurfaceNet::LabelStorage::ReferenceLabels, MMSurfaceNet::VertexOrder::ScanOrder);
+		if (!cellMap.isValid()) return false;
+		cellMap.relax(relaxAttrs);
+		m_peakMemorySize = std::max(m_peakMemorySize, window.size() + cellMap.memorySize());
+
+		// Pass the vertices of the slab's cells to the sink. Cell slice k of the window is
+		// cell slice k + begin of the whole volume. Positions are computed from the cell
+		// index in the whole volume so that they are rounded as in MMCellMap.
+		int firstVtx = cellMap.firstVertexInSlice(slabBegin - begin);
+		int endVtx = cellMap.firstVertexInSlice(slabEnd - begin);
+		for (int idxVtx = firstVtx; idxVtx < endVtx; idxVtx++) {
+			int cellIndex[3];
+			float offset[3];
+			float position[3];
+			cellMap.getVertexCellIndex(idxVtx, cellIndex);
+			cellMap.getVertexOffset(idxVtx, offset);
+			cellIndex[2] += begin;
+			for (int i = 0; i < 3; i++) position[i] = m_voxelSize[i] * (cellIndex[i] + offset[i]);
+			sink.addVertex(m_numVertices + (idxVtx - firstVtx), position);
+		}
+
+		// Pass the quads of the slab's cells to the sink in the order used for export
+		const MMCellFlag::Edge edges[3] = { MMCellFlag::Edge::BackBottomEdge,
+			MMCellFlag::Edge::LeftBottomEdge, MMCellFlag::Edge::LeftBackEdge };
+		for (int idxVtx = firstVtx; idxVtx < endVtx; idxVtx++) {
+			for (int idxEdge = 0; idxEdge < 3; idxEdge++) {
+				int vertexIndices[4];
+				unsigned int quadLabels[2];
+				if (cellMap.getEdgeQuad(idxVtx, edges[idxEdge], vertexIndices, quadLabels)) {
+					size_t quadVtxIndices[4];
+					for (int i = 0; i < 4; i++) {
+						quadVtxIndices[i] = m_numVertices + vertexIndices[i] - firstVtx;
+					}
+					sink.addQuad(quadVtxIndices, quadLabels);
+					m_numQuads++;
+				}
+			}
+		}
+		m_numVertices += endVtx - firstVtx;
+	}
+	return true;
+}
+
+// Seek to a byte offset from the start of a file. Offsets are not limited to a long,
+// which is 32-bit on Windows; offsets that the file API cannot represent are rejected.
+static bool seekFromStart(FILE *fp, size_t offset)
+{
+#if defined(_WIN32)
+	if (offset > (size_t)std::numeric_limits<__int64>::max()) return false;
+	return _fseeki64(fp, (__int64)offset, SEEK_SET) == 0;
+#else
+	if (offset > (size_t)std::numeric_limits<off_t>::max()) return false;
+	return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Surface a raw label file. Slices are read in order, so the file is read sequentially.
+bool MMSurfaceNetStream::surface(const char *fileName, size_t headerSize,
+	MMSurfaceNet::RelaxAttrs relaxAttrs, Sink &sink)
+{
+	FILE *fp;
+	if (!(fp = fopen(fileName, "rb"))) return false;
+	if (headerSize > 0 && !seekFromStart(fp, headerSize)) {
+		fclose(fp);
+		return false;
+	}
+	size_t sliceBytes = (size_t)m_arraySize[0] * m_arraySize[1] * MMCellMap::labelSize(m_labelType);
+	bool isSurfaced = surface([&](int /*k*/, void *slice) {
+		return fread(slice, 1, sliceBytes, fp) == sliceBytes;
+	}, relaxAttrs, sink);
+	fclose(fp);
+	return isSurfaced;
+}
+
+// Statistics of the last call to surface()
+size_t MMSurfaceNetStream::numVertices()
+{
+	return m_numVertices;
+}
+size_t MMSurfaceNetStream::numQuads()
+{
+	return m_numQuads;
+}
+size_t MMSurfaceNetStream::peakMemorySize()
+{
+	return m_peakMemorySize;
+}
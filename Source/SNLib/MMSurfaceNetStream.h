@@ -0,0 +1,74 @@
+// MMSurfaceNetStream.h
+//
+// Interface for MMSurfaceNetStream, which builds the SurfaceNet of a label volume
+// slab-by-slab along z so that the whole volume and cell map never need to be in memory
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#ifndef MM_SURFACE_NET_STREAM_H
+#define MM_SURFACE_NET_STREAM_H
+
+#include <cstddef>
+#include <functional>
+
+#include "MMSurfaceNet.h"
+
+class MMSurfaceNetStream
+{
+public:
+	// Labels are read one z-slice at a time. A slice k holds arraySize[0] * arraySize[1]
+	// labels of the label type indexed by x + arraySize[0] * y. Slices are read once
+	// each, in increasing order of k. The reader returns false if the slice cannot be read.
+	typedef MMSurfaceNet::LabelType LabelType;
+	typedef std::function<bool(int k, void *slice)> SliceReader;
+
+	// Finished vertices and quads are passed to a sink as soon as they can no longer
+	// change. Vertices are numbered and positioned as in an MMSurfaceNet of the whole
+	// volume and are passed in increasing order of vertex index. Quads are passed with
+	// their vertex indices in clockwise order and their labels as [labelTopFaceOfQuad,
+	// labelBottomFaceOfQuad], after all of their vertices.
+	class Sink {
+	public:
+		virtual ~Sink() {}
+		virtual void addVertex(size_t vertexIndex, const float position[3]) = 0;
+		virtual void addQuad(const size_t quadVtxIndices[4], const unsigned int quadLabels[2]) = 0;
+	};
+
+	// Stream for a volume of arraySize labels of type labelType, surfaced in slabs of
+	// slabSize z-slices
+	MMSurfaceNetStream(LabelType labelType, int arraySize[3], float voxelSize[3], int slabSize);
+	~MMSurfaceNetStream();
+
+	// Surface the volume and pass its vertices and quads to sink. Returns false if labels
+	// cannot be read or memory cannot be allocated, in which case only part of the
+	// surface has been passed to sink.
+	//
+	// Each slab is surfaced together with a halo of numRelaxIterations + 2 slices on
+	// either side, so that its vertices and quads are the same as those of the whole
+	// volume after Jacobi relaxation. Vertices are always relaxed with Jacobi relaxation
+	// for numRelaxIterations iterations; convergence tolerance and active set relaxation
+	// depend on the whole surface and are not used. Peak memory is bounded by the labels
+	// and cell map of slabSize + 2 * (numRelaxIterations + 2) slices.
+	bool surface(SliceReader sliceReader, MMSurfaceNet::RelaxAttrs relaxAttrs, Sink &sink);
+
+	// Surface a raw label file, stored as a 3D array of labels after headerSize bytes
+	bool surface(const char *fileName, size_t headerSize, MMSurfaceNet::RelaxAttrs relaxAttrs,
+		Sink &sink);
+
+	// Statistics of the last call to surface()
+	size_t numVertices();
+	size_t numQuads();
+	size_t peakMemorySize();
+
+private:
+	LabelType m_labelType;
+	int m_arraySize[3];
+	float m_voxelSize[3];
+	int m_slabSize;
+
+	size_t m_numVertices;
+	size_t m_numQuads;
+	size_t m_peakMemorySize;
+};
+
+#endif
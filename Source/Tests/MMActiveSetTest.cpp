@@ -0,0 +1,105 @@
+// MMActiveSetTest.cpp
+//
+// Checks active-set Jacobi relaxation when the active set saturates, i.e., when every
+// vertex is in the active set, as happens with a very small active-set epsilon. Small
+// sphere volumes are relaxed with and without an active set; the active set may never
+// list more than all of the vertices and vertex positions must stay close to those
+// relaxed without an active set. Build with AddressSanitizer to also check that
+// building the active set stays within its arrays. Returns 0 if all checks pass. Build
+// and run from this directory with, e.g.,
+//
+//   g++ -std=c++14 -O1 -g -fsanitize=address -pthread -I../SNLib MMActiveSetTest.cpp
+//       ../SNLib/*.cpp -o MMActiveSetTest
+//   ./MMActiveSetTest
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include "MMSurfaceNet.h"
+#include "MMGeometryGL.h"
+
+static int numFailures = 0;
+static void check(bool condition, const char *message, int size)
+{
+	if (!condition) {
+		printf("Failed: %s (volume size %d)\n", message, size);
+		numFailures++;
+	}
+}
+
+// Relaxed flat-shaded GL vertex positions of a SurfaceNet
+static std::vector<float> relaxedPositions(MMSurfaceNet &surfaceNet, MMSurfaceNet::RelaxAttrs relaxAttrs,
+	MMSurfaceNet::RelaxStats &stats)
+{
+	surfaceNet.reset();
+	stats = surfaceNet.relax(relaxAttrs);
+	MMGeometryGL geometry(&surfaceNet);
+	std::vector<float> positions;
+	for (size_t idxVertex = 0; idxVertex < geometry.numVertices(); idxVertex++) {
+		const float *vertex = &geometry.vertices()[8 * idxVertex];
+		positions.insert(positions.end(), vertex, vertex + 3);
+	}
+	return positions;
+}
+
+int main()
+{
+	MMSurfaceNet::RelaxAttrs relaxAttrs;
+	relaxAttrs.numRelaxIterations = 20;
+	relaxAttrs.relaxFactor = 0.5f;
+	relaxAttrs.maxDistFromCellCenter = 1.0f;
+	relaxAttrs.relaxMethod = MMSurfaceNet::RelaxMethod::Jacobi;
+	relaxAttrs.numThreads = 1;
+	relaxAttrs.convergenceTolerance = 0.0f;
+	relaxAttrs.convergenceNorm = MMSurfaceNet::ConvergenceNorm::MaxDisplacement;
+	relaxAttrs.activeSetEpsilon = 0.0f;
+	float voxelSize[3] = { 1.0f, 1.0f, 1.0f };
+
+	// A sphere of label 1 in a volume of label 0, for volumes of 3 to 19 voxels
+	for (int size = 3; size <= 19; size++) {
+		int arraySize[3] = { size, size, size };
+		std::vector<unsigned char> labels((size_t)size * size * size);
+		float center = 0.5f * (size - 1);
+		float radius = 0.35f * size;
+		for (int k = 0; k < size; k++) {
+			for (int j = 0; j < size; j++) {
+				for (int i = 0; i < size; i++) {
+					float d2 = (i - center) * (i - center) + (j - center) * (j - center) +
+						(k - center) * (k - center);
+					labels[i + size * (j + size * k)] = (d2 < radius * radius) ? 1 : 0;
+				}
+			}
+		}
+		MMSurfaceNet surfaceNet(labels.data(), arraySize, voxelSize);
+
+		MMSurfaceNet::RelaxStats stats;
+		relaxAttrs.activeSetEpsilon = 0.0f;
+		std::vector<float> positions = relaxedPositions(surfaceNet, relaxAttrs, stats);
+		relaxAttrs.activeSetEpsilon = 1e-7f;
+		MMSurfaceNet::RelaxStats activeStats;
+		std::vector<float> activePositions = relaxedPositions(surfaceNet, relaxAttrs, activeStats);
+
+		// The first iteration relaxes all vertices, and later active sets are subsets
+		bool isSubset = true;
+		for (size_t idx = 1; idx < activeStats.activeSetSizes.size(); idx++) {
+			if (activeStats.activeSetSizes[idx] > activeStats.activeSetSizes[0]) isSubset = false;
+		}
+		check(activeStats.numIterations == relaxAttrs.numRelaxIterations, "number of iterations", size);
+		check(activeStats.activeSetSizes.size() == (size_t)activeStats.numIterations,
+			"an active set size per iteration", size);
+		check(isSubset, "active sets list at most all vertices", size);
+		check(activePositions.size() == positions.size(), "number of GL vertices", size);
+		float maxDiff = 0.0f;
+		for (size_t idx = 0; idx < positions.size() && idx < activePositions.size(); idx++) {
+			maxDiff = std::max(maxDiff, std::fabs(positions[idx] - activePositions[idx]));
+		}
+		check(maxDiff < 1e-4f, "positions match relaxation without an active set", size);
+	}
+
+	printf("MMCellMap saturated active set: %d failures\n", numFailures);
+	return (numFailures == 0) ? 0 : 1;
+}
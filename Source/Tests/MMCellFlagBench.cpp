@@ -0,0 +1,88 @@
+// MMCellFlagBench.cpp
+//
+// Microbenchmark of MMCellFlag::set(), which looks up cell flags by the partition of
+// the 8 corner labels, against MMCellFlag::setReference(), which computes them
+// directly. Cells are drawn from surface-like volumes in which a given fraction of
+// cells lie inside a single material; boundary cells have 2 to 4 distinct labels.
+// Prints the time per cell of each method. Build and run from this directory with,
+// e.g.,
+//
+//   g++ -std=c++14 -O2 -I../SNLib MMCellFlagBench.cpp ../SNLib/MMCellFlag.cpp -o MMCellFlagBench
+//   ./MMCellFlagBench
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "MMCellFlag.h"
+
+static const int numCells = 1 << 22;
+static const int numPasses = 3;
+
+// Corner labels of numCells cells, of which a fraction homogeneousFraction have a
+// single label
+static std::vector<unsigned int> makeCellLabels(double homogeneousFraction)
+{
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::vector<unsigned int> cellLabels(8 * (size_t)numCells);
+	for (int idxCell = 0; idxCell < numCells; idxCell++) {
+		unsigned int *labels = &cellLabels[8 * (size_t)idxCell];
+		unsigned int alphabet[4];
+		for (int i = 0; i < 4; i++) alphabet[i] = random() % 256;
+		if (uniform(random) < homogeneousFraction) {
+			for (int i = 0; i < 8; i++) labels[i] = alphabet[0];
+			continue;
+		}
+		int numLabels = 2 + random() % 3;
+		for (int i = 0; i < 8; i++) labels[i] = alphabet[random() % numLabels];
+		labels[random() % 8] = alphabet[0];
+		labels[random() % 8] = alphabet[1];
+	}
+	return cellLabels;
+}
+
+// Nanoseconds per cell of the best of numPasses passes. The flag bits are summed so
+// that the flags are not optimized away.
+template <typename SetFlag>
+static double timeCells(std::vector<unsigned int> &cellLabels, SetFlag setFlag,
+	unsigned int &checksum)
+{
+	double bestSeconds = 0.0;
+	for (int pass = 0; pass < numPasses; pass++) {
+		auto start = std::chrono::steady_clock::now();
+		for (int idxCell = 0; idxCell < numCells; idxCell++) {
+			MMCellFlag flag;
+			setFlag(flag, &cellLabels[8 * (size_t)idxCell]);
+			unsigned int bits;
+			memcpy(&bits, &flag, sizeof(bits));
+			checksum += bits;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (pass == 0 || seconds < bestSeconds) bestSeconds = seconds;
+	}
+	return 1e9 * bestSeconds / numCells;
+}
+
+int main()
+{
+	const double homogeneousFractions[] = { 0.9, 0.5, 0.0 };
+	printf("%d cells, best of %d passes, ns per cell\n", numCells, numPasses);
+	for (double homogeneousFraction : homogeneousFractions) {
+		std::vector<unsigned int> cellLabels = makeCellLabels(homogeneousFraction);
+		unsigned int tableChecksum = 0;
+		unsigned int referenceChecksum = 0;
+		double referenceTime = timeCells(cellLabels, [](MMCellFlag &flag, unsigned int *labels) {
+			flag.setReference(labels); }, referenceChecksum);
+		double tableTime = timeCells(cellLabels, [](MMCellFlag &flag, unsigned int *labels) {
+			flag.set(labels); }, tableChecksum);
+		printf("%3.0f%% homogeneous cells: reference %6.1f  table %6.1f%s\n",
+			100.0 * homogeneousFraction, referenceTime, tableTime,
+			(tableChecksum == referenceChecksum) ? "" : "  (flags differ)");
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+// MMCellFlagTest.cpp
+//
+// Exhaustive check that MMCellFlag::set(), which looks up cell flags in a table
+// indexed by the partition of the 8 corner labels into sets of equal labels, gives
+// the same flag as MMCellFlag::setReference() for every partition. Returns 0 if all
+// flags match. Build and run from this directory with, e.g.,
+//
+//   g++ -std=c++14 -O2 -I../SNLib MMCellFlagTest.cpp ../SNLib/MMCellFlag.cpp -o MMCellFlagTest
+//   ./MMCellFlagTest
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <random>
+
+#include "MMCellFlag.h"
+
+// Compare the table and reference flags of one set of corner labels
+static bool flagsMatch(unsigned int cellLabels[8])
+{
+	MMCellFlag flag;
+	MMCellFlag referenceFlag;
+	flag.set(cellLabels);
+	referenceFlag.setReference(cellLabels);
+	return memcmp(&flag, &referenceFlag, sizeof(MMCellFlag)) == 0;
+}
+
+static void printLabels(const char *message, unsigned int cellLabels[8])
+{
+	printf("%s:", message);
+	for (int i = 0; i < 8; i++) printf(" %u", cellLabels[i]);
+	printf("\n");
+}
+
+int main()
+{
+	int numFailures = 0;
+
+	// Every assignment of 8 labels to the 8 corners, which includes every partition
+	// of the corners (and every partition many times, with different label orders)
+	unsigned int cellLabels[8];
+	long long numTuples = 0;
+	for (int code = 0; code < (1 << 24); code++) {
+		for (int i = 0; i < 8; i++) cellLabels[i] = (code >> (3 * i)) & 7;
+		numTuples++;
+		if (!flagsMatch(cellLabels)) {
+			if (numFailures++ < 10) printLabels("Mismatch", cellLabels);
+		}
+	}
+
+	// Random labels spanning the range of the label types, including the padding
+	// labels of each type, drawn from small alphabets so that labels repeat
+	std::mt19937 random(1);
+	const unsigned int specialLabels[] = { 0, 1, UCHAR_MAX, USHRT_MAX, UINT_MAX - 1, UINT_MAX };
+	for (int test = 0; test < 1000000; test++) {
+		unsigned int alphabet[4];
+		for (int i = 0; i < 4; i++) {
+			alphabet[i] = (random() & 1) ? specialLabels[random() % 6] : (unsigned int)random();
+		}
+		for (int i = 0; i < 8; i++) cellLabels[i] = alphabet[random() % 4];
+		numTuples++;
+		if (!flagsMatch(cellLabels)) {
+			if (numFailures++ < 10) printLabels("Mismatch", cellLabels);
+		}
+	}
+
+	printf("MMCellFlag partition table: %lld label tuples, %d mismatches\n", numTuples, numFailures);
+	return (numFailures == 0) ? 0 : 1;
+}
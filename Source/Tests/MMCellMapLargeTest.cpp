@@ -0,0 +1,198 @@
+// MMCellMapLargeTest.cpp
+//
+// Checks 64-bit cell and label indexing and the vertex count limit of MMCellMap.
+//
+// A small two-label object is surfaced near the far corner of a volume with more than
+// 2^31 labels and cells, where its label indices do not fit in an int, and compared
+// with the same object in a small volume. The rest of the large volume is padding, so
+// it has no vertices. Its labels are mapped from a single 64 MB block of padding labels
+// so that little memory is used (POSIX only). The vertex limit is lowered with
+// MM_MAX_NUM_VERTICES so that it can be exceeded by a small volume, which must give
+// invalid SurfaceNets and GL geometry. Returns 0 if all checks pass. Build and run from this directory with, e.g.,
+//
+//   g++ -std=c++14 -O2 -pthread -DMM_MAX_NUM_VERTICES=10000 -I../SNLib MMCellMapLargeTest.cpp
+//       ../SNLib/*.cpp -o MMCellMapLargeTest
+//   ./MMCellMapLargeTest
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "MMCellMap.h"
+#include "MMGeometryGL.h"
+
+static int numFailures = 0;
+static void check(bool condition, const char *message)
+{
+	if (!condition) {
+		printf("Failed: %s\n", message);
+		numFailures++;
+	}
+}
+
+// Map a read-write array of numBytes padding labels. All blocks of the array map the
+// same file, so the array only uses memory for the file and for pages that are written.
+static unsigned char *mapPaddingLabels(size_t numBytes, size_t &mappedBytes)
+{
+	const size_t blockBytes = (size_t)1 << 26;
+	size_t numBlocks = (numBytes + blockBytes - 1) / blockBytes;
+	mappedBytes = numBlocks * blockBytes;
+	FILE *file = tmpfile();
+	if (file == NULL) return NULL;
+	std::vector<unsigned char> block(blockBytes, 0xFF);
+	bool isWritten = (fwrite(block.data(), 1, blockBytes, file) == blockBytes) && (fflush(file) == 0);
+	void *labels = isWritten ? mmap(NULL, mappedBytes, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) : MAP_FAILED;
+	for (size_t idxBlock = 0; labels != MAP_FAILED && idxBlock < numBlocks; idxBlock++) {
+		void *blockLabels = (unsigned char *)labels + idxBlock * blockBytes;
+		if (mmap(blockLabels, blockBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+			fileno(file), 0) == MAP_FAILED) {
+			munmap(labels, mappedBytes);
+			labels = MAP_FAILED;
+		}
+	}
+	fclose(file);
+	return (labels == MAP_FAILED) ? NULL : (unsigned char *)labels;
+}
+
+// Label the 4 x 4 x 4 object with left-back-bottom corner (i, j, k) in an array of
+// padding labels. The left half of the object has label 1 and the right half label 2.
+static void setObjectLabels(unsigned char *labels, int arraySize[3], int i, int j, int k)
+{
+	for (int z = k; z < k + 4; z++) {
+		for (int y = j; y < j + 4; y++) {
+			for (int x = i; x < i + 4; x++) {
+				labels[x + (size_t)arraySize[0] * (y + (size_t)arraySize[1] * z)] = (x < i + 2) ? 1 : 2;
+			}
+		}
+	}
+}
+
+// Compare the vertices, quads and relaxed vertex offsets of cell maps that contain the
+// same object, where the object in the large cell map is offset by cellOffset cells
+static void compareCellMaps(MMCellMap &cellMap, MMCellMap &largeCellMap, int cellOffset[3])
+{
+	check(cellMap.isValid() && largeCellMap.isValid(), "cell maps are valid");
+	if (!cellMap.isValid() || !largeCellMap.isValid()) return;
+	check(cellMap.numVertices() > 0, "object has vertices");
+	check(largeCellMap.numVertices() == cellMap.numVertices(), "number of vertices");
+	check(largeCellMap.numEdgeCrossings() == cellMap.numEdgeCrossings(), "number of edge crossings");
+	if (largeCellMap.numVertices() != cellMap.numVertices()) return;
+
+	MMSurfaceNet::RelaxAttrs relaxAttrs;
+	relaxAttrs.numRelaxIterations = 20;
+	relaxAttrs.relaxFactor = 0.5f;
+	relaxAttrs.maxDistFromCellCenter = 1.0f;
+	relaxAttrs.relaxMethod = MMSurfaceNet::RelaxMethod::Jacobi;
+	relaxAttrs.numThreads = 0;
+	relaxAttrs.convergenceTolerance = 0.0f;
+	relaxAttrs.convergenceNorm = MMSurfaceNet::ConvergenceNorm::MaxDisplacement;
+	relaxAttrs.activeSetEpsilon = 0.0f;
+	cellMap.reset();
+	cellMap.relax(relaxAttrs);
+	largeCellMap.relax(relaxAttrs);
+
+	bool isSameCell = true, isSameType = true, isSameQuad = true, isSameOffset = true;
+	for (int idxVtx = 0; idxVtx < cellMap.numVertices(); idxVtx++) {
+		int cellIndex[3], largeCellIndex[3];
+		cellMap.getVertexCellIndex(idxVtx, cellIndex);
+		largeCellMap.getVertexCellIndex(idxVtx, largeCellIndex);
+		for (int i = 0; i < 3; i++) {
+			if (largeCellIndex[i] != cellIndex[i] + cellOffset[i]) isSameCell = false;
+		}
+		if (largeCellMap.vertexType(idxVtx) != cellMap.vertexType(idxVtx)) isSameType = false;
+		for (int edge = 0; edge < 12; edge++) {
+			int quadVtxIndices[4], largeQuadVtxIndices[4];
+			unsigned int quadLabels[2], largeQuadLabels[2];
+			bool isQuad = cellMap.getEdgeQuad(idxVtx, (MMCellFlag::Edge)edge, quadVtxIndices, quadLabels);
+			bool isLargeQuad = largeCellMap.getEdgeQuad(idxVtx, (MMCellFlag::Edge)edge, largeQuadVtxIndices,
+				largeQuadLabels);
+			if (isLargeQuad != isQuad) isSameQuad = false;
+			if (isQuad && isLargeQuad && (memcmp(quadVtxIndices, largeQuadVtxIndices, sizeof(quadVtxIndices)) ||
+				memcmp(quadLabels, largeQuadLabels, sizeof(quadLabels)))) {
+				isSameQuad = false;
+			}
+		}
+		float offset[3], largeOffset[3];
+		cellMap.getVertexOffset(idxVtx, offset);
+		largeCellMap.getVertexOffset(idxVtx, largeOffset);
+		if (memcmp(offset, largeOffset, sizeof(offset))) isSameOffset = false;
+	}
+	check(isSameCell, "vertex cell indices");
+	check(isSameType, "vertex types");
+	check(isSameQuad, "quad vertex indices and labels");
+	check(isSameOffset, "relaxed vertex offsets");
+}
+
+int main()
+{
+	float voxelSize[3] = { 1.0f, 1.0f, 1.0f };
+	MMSurfaceNet::LabelType labelType = MMSurfaceNet::LabelType::UInt8;
+	MMSurfaceNet::VertexOrder scanOrder = MMSurfaceNet::VertexOrder::ScanOrder;
+
+	// The object in a small volume
+	int arraySize[3] = { 8, 8, 8 };
+	std::vector<unsigned char> labels(8 * 8 * 8, 0xFF);
+	setObjectLabels(labels.data(), arraySize, 2, 2, 2);
+	MMCellMap cellMap(labels.data(), labelType, arraySize, voxelSize,
+		MMSurfaceNet::LabelStorage::ReferenceLabels, scanOrder);
+
+	// The object in a volume of 2048 x 1024 x 1040 labels. Its labels and cells all have
+	// indices larger than 2^31.
+	int largeArraySize[3] = { 2048, 1024, 1040 };
+	int objectCorner[3] = { 2040, 1016, 1030 };
+	size_t numLabels = (size_t)largeArraySize[0] * largeArraySize[1] * largeArraySize[2];
+	size_t mappedBytes = 0;
+	unsigned char *largeLabels = mapPaddingLabels(numLabels, mappedBytes);
+	check(largeLabels != NULL, "map large label array");
+	if (largeLabels != NULL) {
+		setObjectLabels(largeLabels, largeArraySize, objectCorner[0], objectCorner[1], objectCorner[2]);
+		size_t objectLabelIndex = objectCorner[0] + (size_t)largeArraySize[0] * (objectCorner[1] +
+			(size_t)largeArraySize[1] * objectCorner[2]);
+		check(objectLabelIndex > (size_t)1 << 31, "object label indices exceed 2^31");
+		int cellOffset[3] = { objectCorner[0] - 2, objectCorner[1] - 2, objectCorner[2] - 2 };
+
+		MMCellMap::LabelStorage largeStorage[2] = {
+			MMSurfaceNet::LabelStorage::ReferenceLabels, MMSurfaceNet::LabelStorage::CompressLabels };
+		for (int idxStorage = 0; idxStorage < 2; idxStorage++) {
+			MMCellMap largeCellMap(largeLabels, labelType, largeArraySize, voxelSize,
+				largeStorage[idxStorage], scanOrder);
+			compareCellMaps(cellMap, largeCellMap, cellOffset);
+		}
+		munmap(largeLabels, mappedBytes);
+	}
+
+	// Vertex limit. Every cell of a checkerboard has a vertex, except for cells in the
+	// right, front and top faces of the padded cell grid.
+	for (int size = 8; size <= 64; size *= 2) {
+		int checkerSize[3] = { size, size, size };
+		std::vector<unsigned char> checkerLabels((size_t)size * size * size);
+		for (size_t idx = 0; idx < checkerLabels.size(); idx++) {
+			checkerLabels[idx] = (idx % size + idx / size % size + idx / size / size) & 1;
+		}
+		MMCellMap checkerCellMap(checkerLabels.data(), labelType, checkerSize, voxelSize,
+			MMSurfaceNet::LabelStorage::ReferenceLabels, scanOrder);
+		MMSurfaceNet checkerSurfaceNet(checkerLabels.data(), checkerSize, voxelSize);
+		MMGeometryGL checkerGeometry(&checkerSurfaceNet);
+		size_t numVertexCells = (size_t)(size + 1) * (size + 1) * (size + 1);
+		if (numVertexCells <= MM_MAX_NUM_VERTICES) {
+			check(checkerCellMap.isValid() && checkerCellMap.numVertices() == (int)numVertexCells,
+				"surface within the vertex limit is made");
+			check(checkerSurfaceNet.isValid() && checkerGeometry.isValid() &&
+				checkerGeometry.numIndices() > 0, "SurfaceNet within the vertex limit is valid");
+		}
+		else {
+			check(!checkerCellMap.isValid() && checkerCellMap.numVertices() == 0,
+				"surface over the vertex limit is empty");
+			check(!checkerSurfaceNet.isValid() && !checkerGeometry.isValid() &&
+				checkerGeometry.numIndices() == 0, "SurfaceNet over the vertex limit is invalid");
+		}
+	}
+
+	printf("MMCellMap large indexing and vertex limit: %d failures\n", numFailures);
+	return (numFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+// MMVertexOrderBench.cpp
+//
+// Benchmark of SurfaceNets with vertices in MMSurfaceNet::VertexOrder::ScanOrder and
+// BrickOrder. Times construction, 20 iterations of Jacobi and of sequential
+// relaxation and GL geometry generation on a volume of overlapping random spheres
+// with 16-bit labels, and prints the best of numRuns runs of each vertex order.
+// Jacobi relaxation does not depend on the vertex order, so the GL vertex checksums
+// of the Jacobi-relaxed surfaces of the two orders must match. Returns 0 if they do.
+// Build and run from this directory with, e.g.,
+//
+//   g++ -std=c++14 -O2 -pthread -I../SNLib MMVertexOrderBench.cpp ../SNLib/*.cpp -o MMVertexOrderBench
+//   ./MMVertexOrderBench 512 512 512 12
+//
+// where the arguments are the array size and the number of spheres.
+//
+// Sarah Frisken, Brigham and Women's Hospital, Boston MA USA
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "MMSurfaceNet.h"
+#include "MMGeometryGL.h"
+
+static const int numRuns = 2;
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Overlapping spheres with random centers and radii, each with its own label
+static std::vector<unsigned short> makeSpheres(int arraySize[3], int numSpheres)
+{
+	std::mt19937 random(1);
+	std::vector<unsigned short> labels((size_t)arraySize[0] * arraySize[1] * arraySize[2], 0);
+	int minSize = std::min(arraySize[0], std::min(arraySize[1], arraySize[2]));
+	for (int idxSphere = 0; idxSphere < numSpheres; idxSphere++) {
+		float center[3];
+		for (int i = 0; i < 3; i++) center[i] = (float)(random() % arraySize[i]);
+		float radius = (float)(minSize / 8 + random() % (minSize / 4 + 1));
+		int begin[3], end[3];
+		for (int i = 0; i < 3; i++) {
+			begin[i] = std::max(0, (int)(center[i] - radius));
+			end[i] = std::min(arraySize[i], (int)(center[i] + radius) + 2);
+		}
+		for (int k = begin[2]; k < end[2]; k++) {
+			for (int j = begin[1]; j < end[1]; j++) {
+				for (int i = begin[0]; i < end[0]; i++) {
+					float d[3] = { i - center[0], j - center[1], k - center[2] };
+					if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] < radius * radius) {
+						labels[i + arraySize[0] * (j + (size_t)arraySize[1] * k)] =
+							(unsigned short)(idxSphere + 1);
+					}
+				}
+			}
+		}
+	}
+	return labels;
+}
+
+struct Times {
+	double build;
+	double jacobi;
+	double sequential;
+	double geometry;
+};
+
+// Times of one run, with a checksum of the GL vertex positions of the Jacobi-relaxed
+// SurfaceNet
+static Times timeRun(std::vector<unsigned short> &labels, int arraySize[3],
+	MMSurfaceNet::VertexOrder vertexOrder, double &checksum)
+{
+	float voxelSize[3] = { 1.0f, 1.0f, 1.0f };
+	Times times;
+	auto start = std::chrono::steady_clock::now();
+	MMSurfaceNet surfaceNet(labels.data(), arraySize, voxelSize,
+		MMSurfaceNet::LabelStorage::CopyLabels, vertexOrder);
+	times.build = elapsedMs(start);
+
+	MMSurfaceNet::RelaxAttrs relaxAttrs = MMSurfaceNet::RelaxAttrs();
+	relaxAttrs.numRelaxIterations = 20;
+	relaxAttrs.relaxFactor = 0.5f;
+	relaxAttrs.maxDistFromCellCenter = 1.0f;
+	relaxAttrs.numThreads = 1;
+	relaxAttrs.relaxMethod = MMSurfaceNet::RelaxMethod::Sequential;
+	start = std::chrono::steady_clock::now();
+	surfaceNet.relax(relaxAttrs);
+	times.sequential = elapsedMs(start);
+	surfaceNet.reset();
+	relaxAttrs.relaxMethod = MMSurfaceNet::RelaxMethod::Jacobi;
+	start = std::chrono::steady_clock::now();
+	surfaceNet.relax(relaxAttrs);
+	times.jacobi = elapsedMs(start);
+
+	start = std::chrono::steady_clock::now();
+	MMGeometryGL geometry(&surfaceNet);
+	times.geometry = elapsedMs(start);
+	checksum = 0.0;
+	for (size_t idxVtx = 0; idxVtx < geometry.numVertices(); idxVtx++) {
+		const float *vertex = &geometry.vertices()[8 * idxVtx];
+		checksum += vertex[0] + 2.0 * vertex[1] + 3.0 * vertex[2];
+	}
+	return times;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 1 && argc != 5) {
+		printf("Usage: %s [sizeX sizeY sizeZ numSpheres]\n", argv[0]);
+		return 1;
+	}
+	int arraySize[3] = { 256, 256, 256 };
+	int numSpheres = 12;
+	if (argc == 5) {
+		for (int i = 0; i < 3; i++) arraySize[i] = atoi(argv[i + 1]);
+		numSpheres = atoi(argv[4]);
+	}
+	std::vector<unsigned short> labels = makeSpheres(arraySize, numSpheres);
+
+	printf("%d x %d x %d, %d spheres, best of %d runs, ms\n", arraySize[0], arraySize[1],
+		arraySize[2], numSpheres, numRuns);
+	const MMSurfaceNet::VertexOrder vertexOrders[2] = { MMSurfaceNet::VertexOrder::ScanOrder,
+		MMSurfaceNet::VertexOrder::BrickOrder };
+	const char *orderNames[2] = { "scan", "brick" };
+	double checksums[2];
+	for (int idxOrder = 0; idxOrder < 2; idxOrder++) {
+		Times best = timeRun(labels, arraySize, vertexOrders[idxOrder], checksums[idxOrder]);
+		for (int run = 1; run < numRuns; run++) {
+			Times times = timeRun(labels, arraySize, vertexOrders[idxOrder], checksums[idxOrder]);
+			best.build = std::min(best.build, times.build);
+			best.jacobi = std::min(best.jacobi, times.jacobi);
+			best.sequential = std::min(best.sequential, times.sequential);
+			best.geometry = std::min(best.geometry, times.geometry);
+		}
+		printf("%-5s  build %7.0f  jacobi %7.0f  sequential %7.0f  GL %7.0f\n", orderNames[idxOrder],
+			best.build, best.jacobi, best.sequential, best.geometry);
+	}
+
+	// GL vertices are listed by quad in vertex order, so the sum is only compared
+	// to rounding error
+	double difference = std::abs(checksums[0] - checksums[1]);
+	if (difference > 1e-6 * std::abs(checksums[0])) {
+		printf("GL vertex checksums differ: %.9e %.9e\n", checksums[0], checksums[1]);
+		return 1;
+	}
+	return 0;
+}